@@ -0,0 +1,227 @@
+#include "Batch.h"
+
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+WorkStealingPool::WorkStealingPool(unsigned threads) : threads(threads ? threads : 1), queues(threads ? threads : 1)
+{
+}
+
+// take the next job for worker self: its own newest, otherwise steal
+// another worker's oldest
+bool WorkStealingPool::next(unsigned self, size_t &job)
+{
+	{
+		lock_guard<mutex> guard(queues[self].lock);
+		if (!queues[self].jobs.empty())
+		{
+			job = queues[self].jobs.back();
+			queues[self].jobs.pop_back();
+			return true;
+		}
+	}
+
+	for (unsigned i = 1; i < threads; i++)
+	{
+		WorkQueue &victim = queues[(self + i) % threads];
+		lock_guard<mutex> guard(victim.lock);
+		if (!victim.jobs.empty())
+		{
+			job = victim.jobs.front();
+			victim.jobs.pop_front();
+			return true;
+		}
+	}
+
+	// every job has been handed out (no new ones are ever added)
+	return false;
+}
+
+void WorkStealingPool::run(size_t count, const function<void(size_t)> &job)
+{
+	// deal out contiguous chunks; each worker pops from the back, so it
+	// works through its chunk in reverse while thieves take from the front
+	for (unsigned t = 0; t < threads; t++)
+	{
+		size_t first = count * t / threads;
+		size_t last = count * (t + 1) / threads;
+		for (size_t i = first; i < last; i++)
+		{
+			queues[t].jobs.push_back(i);
+		}
+	}
+
+	vector<thread> workers;
+	for (unsigned t = 0; t < threads; t++)
+	{
+		workers.push_back(thread([this, t, &job]()
+								 {
+									 size_t i;
+									 while (next(t, i))
+									 {
+										 job(i);
+									 }
+								 }));
+	}
+	for (size_t t = 0; t < workers.size(); t++)
+	{
+		workers[t].join();
+	}
+}
+
+// one manifest entry: a program and the state to start it in
+struct BatchJob
+{
+	string program;
+	string checkpoint; // restored after loading, if set
+	vector<pair<int, int32_t> > registers;
+	vector<pair<uint32_t, uint32_t> > words;
+};
+
+// the whole of text as a number (decimal, 0x hex or 0 octal)
+static bool parseNumber(const string &text, int64_t &value)
+{
+	char *end;
+	value = strtoll(text.c_str(), &end, 0);
+	return !text.empty() && *end == '\0';
+}
+
+static bool parseJob(const string &line, BatchJob &job, string &error)
+{
+	stringstream ss(line);
+	ss >> job.program;
+
+	string token;
+	while (ss >> token)
+	{
+		size_t eq = token.find('=');
+		if (eq == string::npos || eq == 0 || eq + 1 == token.size())
+		{
+			error = "bad manifest entry " + token;
+			return false;
+		}
+		string key = token.substr(0, eq);
+		int64_t value;
+		if (key == "restore")
+		{
+			job.checkpoint = token.substr(eq + 1);
+			continue;
+		}
+		if (!parseNumber(token.substr(eq + 1), value))
+		{
+			error = "bad value in " + token;
+			return false;
+		}
+
+		if (key[0] == 'x')
+		{
+			int64_t reg;
+			if (!parseNumber(key.substr(1), reg) || reg < 0 || reg > 31)
+			{
+				error = "bad register " + key;
+				return false;
+			}
+			job.registers.push_back(make_pair((int)reg, (int32_t)value));
+		}
+		else if (key[0] == '@')
+		{
+			int64_t addr;
+			if (!parseNumber(key.substr(1), addr))
+			{
+				error = "bad address " + key;
+				return false;
+			}
+			job.words.push_back(make_pair((uint32_t)addr, (uint32_t)value));
+		}
+		else
+		{
+			error = "bad manifest entry " + token;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool runBatch(const char *manifest, const SimOptions &opt, unsigned threads, string &error)
+{
+	ifstream infile(manifest);
+	if (!(infile.is_open() && infile.good()))
+	{
+		error = "error opening file";
+		return false;
+	}
+
+	vector<BatchJob> jobs;
+	string line;
+	unsigned lineNumber = 0;
+	while (getline(infile, line))
+	{
+		lineNumber++;
+		size_t start = line.find_first_not_of(" \t\r");
+		if (start == string::npos || line[start] == '#')
+			continue;
+
+		BatchJob job;
+		if (!parseJob(line, job, error))
+		{
+			stringstream where;
+			where << "manifest line " << lineNumber << ": " << error;
+			error = where.str();
+			return false;
+		}
+		jobs.push_back(job);
+	}
+
+	// each job writes only its own slot, so output order is the manifest order
+	vector<string> results(jobs.size());
+
+	WorkStealingPool pool(threads);
+	pool.run(jobs.size(), [&](size_t i)
+			 {
+				 const BatchJob &job = jobs[i];
+				 CPU cpu;
+				 GuestMemory instMem;
+				 Program prog;
+				 string jobError;
+
+				 if (!loadIntoCPU(job.program.c_str(), cpu, instMem, prog, jobError))
+				 {
+					 results[i] = jobError;
+					 return;
+				 }
+				 if (!job.checkpoint.empty() && !cpu.restoreCheckpoint(job.checkpoint.c_str(), jobError))
+				 {
+					 results[i] = jobError;
+					 return;
+				 }
+				 for (size_t r = 0; r < job.registers.size(); r++)
+				 {
+					 cpu.setReg(job.registers[r].first, job.registers[r].second);
+				 }
+				 for (size_t w = 0; w < job.words.size(); w++)
+				 {
+					 cpu.dataMemory().write32(job.words[w].first, job.words[w].second);
+				 }
+
+				 if (!runProgram(cpu, instMem, prog, opt, jobError))
+				 {
+					 results[i] = jobError;
+					 return;
+				 }
+
+				 stringstream out;
+				 out << "(" << cpu.readReg(10) << "," << cpu.readReg(11) << ")";
+				 if (cpu.stopReason() != STOP_NONE)
+				 {
+					 out << " stopped: " << stopReasonName(cpu.stopReason());
+				 }
+				 results[i] = out.str();
+			 });
+
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		cout << results[i] << endl;
+	}
+	return true;
+}
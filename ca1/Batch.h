@@ -0,0 +1,47 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "Simulator.h"
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+using namespace std;
+
+// a fixed set of worker threads that run numbered jobs. every worker starts
+// with its own contiguous share of the jobs and takes from the back of its
+// own queue; once that is empty it steals from the front of another worker's,
+// so a few slow programs do not leave the other cores idle
+class WorkStealingPool
+{
+public:
+	WorkStealingPool(unsigned threads);
+
+	// call job(i) for every i in [0, count) and wait for all of them
+	void run(size_t count, const function<void(size_t)> &job);
+
+private:
+	struct WorkQueue
+	{
+		mutex lock;
+		deque<size_t> jobs;
+	};
+
+	unsigned threads;
+	vector<WorkQueue> queues;
+
+	bool next(unsigned self, size_t &job);
+};
+
+// run every entry of a batch manifest on its own CPU, spread over threads,
+// and print each entry's (a0,a1) in manifest order. each manifest line is
+//   <program> [restore=checkpoint] [xN=value ...] [@address=value ...]
+// where restore=file starts from a checkpoint of that program, xN=value sets
+// a register and @address=value stores a 32-bit word in data memory before
+// the program starts. blank lines and lines starting
+// with # are skipped. returns false if the manifest cannot be read
+bool runBatch(const char *manifest, const SimOptions &opt, unsigned threads, string &error);
+
+#endif
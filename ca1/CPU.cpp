@@ -3,7 +3,35 @@
 #include <iostream>
 #include <iomanip>
 
-Instruction::Instruction(bitset<32> fetch)
+// profiling hooks; -DNO_PROFILE removes them from every engine
+#ifdef NO_PROFILE
+#define PROFILE(call)
+#else
+#define PROFILE(call)        \
+	do                       \
+	{                        \
+		if (profile != NULL) \
+			profile->call;   \
+	} while (0)
+#endif
+
+const char *operationName(Operation op)
+{
+	static const char *names[] = {
+#define RV_NAME(name, format, mask, match, flags) #name,
+		RV32IMA_INSTRUCTIONS(RV_NAME)
+#undef RV_NAME
+		"NOP"};
+	return names[op];
+}
+
+const char *stopReasonName(StopReason reason)
+{
+	static const char *names[] = {"none", "ecall", "halt address", "instruction limit", "cycle limit", "watchdog"};
+	return names[reason];
+}
+
+Instruction::Instruction(uint32_t fetch)
 {
 	instr = fetch;
 }
@@ -12,190 +40,925 @@ CPU::CPU()
 {
 	// initialize PC to 0
 	PC = 0;
+	endPC = 0;
+	codeBase = 0;
 	operation = NOP;
 
-	for (int i = 0; i < 4096; i++)
-	{
-		// zero out data memory
-		dmemory[i] = 0;
-	}
+	// data memory pages start out zeroed when first touched
 
-	for (int i = 0; i < 32; i++)
+	for (int i = 0; i <= ZERO_SINK; i++)
 	{
 		// initialize all registers to zero
 		registers[i] = 0;
 	}
+
+	predictor = NULL;
+	profile = NULL;
+	dcache = NULL;
+	coherence = NULL;
+	hartId = 0;
+	retiredCount = 0;
+	stop = STOP_NONE;
+	haltAddress = ~0ull;
+	stopRequested = false;
+	reservationValid = false;
+	reservedAddress = 0;
+	reservedValue = 0;
+	icache = NULL;
+	fetchBuffer = false;
+	fetchLineShift = 0;
+	bufferedLine = ~0ul;
+	bufferHits = 0;
+	fetchLatency = 0;
+	resetPipeline();
 }
 
-bitset<32> CPU::fetch(bitset<8> *instMem)
+// data memory accessors, all going through the paged guest memory. the data
+// cache model (if any) only adds latency; the values always come from dmemory
+inline uint32_t CPU::load(int32_t addr, uint32_t bytes)
 {
-	// get 32-bit instruction
-	bitset<32> instr = ((((instMem[PC + 3].to_ulong()) << 24)) + ((instMem[PC + 2].to_ulong()) << 16) + ((instMem[PC + 1].to_ulong()) << 8) + (instMem[PC].to_ulong()));
-	PC += 4;
-	return instr;
+	PROFILE(load((uint32_t)addr));
+	if (dcache != NULL)
+		memLatency += dcache->read((uint32_t)addr, bytes);
+	if (coherence != NULL)
+		coherence->access(hartId, (uint32_t)addr, false);
+	if (bytes == 1)
+		return dmemory.read8((uint32_t)addr);
+	if (bytes == 2)
+		return dmemory.read16((uint32_t)addr);
+	return dmemory.read32((uint32_t)addr);
 }
 
-void CPU::decode(Instruction *curr)
+inline void CPU::store(int32_t addr, uint32_t bytes, int32_t value)
 {
-	uint32_t instruction = (uint32_t)(curr->instr.to_ulong());
+	PROFILE(store((uint32_t)addr));
+	if (dcache != NULL)
+		memLatency += dcache->write((uint32_t)addr, bytes);
+	if (coherence != NULL)
+		coherence->access(hartId, (uint32_t)addr, true);
+	if ((uint32_t)addr == haltAddress)
+		stop = STOP_HALT_ADDRESS;
+	if (bytes == 1)
+		dmemory.write8((uint32_t)addr, value & 0xFF);
+	else if (bytes == 2)
+		dmemory.write16((uint32_t)addr, value & 0xFFFF);
+	else
+		dmemory.write32((uint32_t)addr, (uint32_t)value);
+}
 
-	uint32_t opcode = instruction & 0x7F;		  // 7 bits
-	uint32_t rd = (instruction >> 7) & 0x1F;	  // 5 bits
-	uint32_t funct3 = (instruction >> 12) & 0x7;  // 3 bits
-	uint32_t rs1 = (instruction >> 15) & 0x1F;	  // 5 bits
-	uint32_t rs2 = (instruction >> 20) & 0x1F;	  // 5 bits
-	uint32_t funct7 = (instruction >> 25) & 0x7F; // 7 bits
+inline int32_t CPU::loadByte(int32_t addr)
+{
+	return (int8_t)load(addr, 1);
+}
 
-	decodeInstr.rs1 = registers[rs1];
-	decodeInstr.rs2 = registers[rs2];
-	decodeInstr.rd = rd;
-	decodeInstr.immediate = (int32_t)curr->instr.to_ulong() >> 20;
+inline int32_t CPU::loadByteUnsigned(int32_t addr)
+{
+	return load(addr, 1);
+}
 
-	switch (opcode)
+inline int32_t CPU::loadHalf(int32_t addr)
+{
+	return (int16_t)load(addr, 2);
+}
+
+inline int32_t CPU::loadHalfUnsigned(int32_t addr)
+{
+	return load(addr, 2);
+}
+
+inline int32_t CPU::loadWord(int32_t addr)
+{
+	return (int32_t)load(addr, 4);
+}
+
+inline void CPU::storeByte(int32_t addr, int32_t value)
+{
+	store(addr, 1, value);
+}
+
+inline void CPU::storeHalf(int32_t addr, int32_t value)
+{
+	store(addr, 2, value);
+}
+
+inline void CPU::storeWord(int32_t addr, int32_t value)
+{
+	store(addr, 4, value);
+}
+
+// do the data memory side of a load or store: returns the loaded value, or
+// writes value for a store
+int32_t CPU::memoryAccess(Operation op, int32_t addr, int32_t value)
+{
+	switch (op)
 	{
-	// r-type
-	case 0x33:
-		if (funct3 == 0x0 && funct7 == 0x0)
-		{
-			operation = ADD;
-		}
-		else if (funct3 == 0x4 && funct7 == 0x0)
-		{
-			operation = XOR;
-		}
+	case LB:
+		return loadByte(addr);
+	case LH:
+		return loadHalf(addr);
+	case LW:
+		return loadWord(addr);
+	case LBU:
+		return loadByteUnsigned(addr);
+	case LHU:
+		return loadHalfUnsigned(addr);
+	case SB:
+		storeByte(addr, value);
 		break;
-	// i-type
-	case 0x13:
-		if (funct3 == 0x5)
-		{
-			operation = SRAI;
-		}
-		else if (funct3 == 0x6)
+	case SH:
+		storeHalf(addr, value);
+		break;
+	case SW:
+		storeWord(addr, value);
+		break;
+	default:
+		if (operationFlags(op) & OP_ATOMIC)
 		{
-			operation = ORI;
+			return atomicAccess(op, addr, value);
 		}
 		break;
-	// load
-	case 0x3:
-		if (funct3 == 0x0)
+	}
+	return 0;
+}
+
+// LR/SC and the AMOs, atomic on the host as well so that harts running on
+// other threads see each one whole. SC succeeds if the reserved word still
+// holds what LR read (a store of the same value in between goes unnoticed,
+// which is the usual compromise for parallel simulation). there are no
+// traps, so a misaligned address just uses the word it falls in
+int32_t CPU::atomicAccess(Operation op, int32_t addr, int32_t value)
+{
+	bool writes = op != LR_W;
+	PROFILE(load((uint32_t)addr));
+	if (writes)
+	{
+		PROFILE(store((uint32_t)addr));
+	}
+	if (dcache != NULL)
+		memLatency += writes ? dcache->write((uint32_t)addr, 4) : dcache->read((uint32_t)addr, 4);
+	if (coherence != NULL)
+		coherence->access(hartId, (uint32_t)addr, writes);
+
+	int32_t *word = (int32_t *)dmemory.page((uint32_t)addr & ~3u);
+	if (op == LR_W)
+	{
+		reservationValid = true;
+		reservedAddress = addr;
+		reservedValue = __atomic_load_n(word, __ATOMIC_SEQ_CST);
+		return reservedValue;
+	}
+	if (op == SC_W)
+	{
+		int32_t expected = reservedValue;
+		bool stored = reservationValid && reservedAddress == addr &&
+					  __atomic_compare_exchange_n(word, &expected, value, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+		reservationValid = false;
+		if (stored && (uint32_t)addr == haltAddress)
+			stop = STOP_HALT_ADDRESS;
+		return stored ? 0 : 1;
+	}
+
+	// compare-and-swap until no other hart got in between the read and the write
+	int32_t old = __atomic_load_n(word, __ATOMIC_SEQ_CST);
+	while (!__atomic_compare_exchange_n(word, &old, amo(op, old, value), false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+	{
+	}
+	if ((uint32_t)addr == haltAddress)
+		stop = STOP_HALT_ADDRESS;
+	return old;
+}
+
+// charge the fetch of the instruction at pc to the instruction cache (if
+// any) and return the cycles it costs. with the fetch buffer only the first
+// fetch from each line reaches the cache
+inline uint32_t CPU::instructionFetch(unsigned long pc)
+{
+	if (icache == NULL)
+	{
+		return 0;
+	}
+	return cachedFetch(pc);
+}
+
+// the instruction cache side of instructionFetch, kept out of line so the
+// engines' dispatch stays small when there is no cache
+uint32_t CPU::cachedFetch(unsigned long pc)
+{
+	if (fetchBuffer)
+	{
+		if ((pc >> fetchLineShift) == bufferedLine)
 		{
-			operation = LB;
+			bufferHits++;
+			return 0;
 		}
-		else if (funct3 == 0x2)
+		bufferedLine = pc >> fetchLineShift;
+	}
+	uint32_t cost = icache->read((uint32_t)pc, 4);
+	fetchLatency += cost;
+	return cost;
+}
+
+// checked by the engines between blocks: a halt in the program or a stop
+// requested from another thread
+inline bool CPU::stopping()
+{
+	return stop != STOP_NONE || stopRequested.load(memory_order_relaxed);
+}
+
+uint32_t CPU::fetch(GuestMemory &instMem)
+{
+	instructionFetch(PC);
+
+	// get 32-bit instruction
+	uint32_t instr = instMem.read32(PC);
+	PC += 4;
+	return instr;
+}
+
+// the decoder indexes a table by the bits that tell instructions apart:
+// opcode[6:2], funct3, bit 20 (ECALL/EBREAK), bit 25 (the M extension) and
+// funct7[6:2] (SUB/SRA and friends). the table is built at compile time from
+// RV32IMA_INSTRUCTIONS, so decoding costs the same however many instructions
+// there are
+static constexpr uint32_t decodeIndex(uint32_t w)
+{
+	return ((w >> 2) & 0x1F) | ((w >> 12) & 0x7) << 5 | ((w >> 20) & 0x1) << 8 | ((w >> 25) & 0x1) << 9 | ((w >> 27) & 0x1F) << 10;
+}
+
+static const uint32_t DECODE_ENTRIES = 1 << 15;
+
+struct DecodeTable
+{
+	uint8_t op[DECODE_ENTRIES];
+	uint32_t mask[NUM_OPERATIONS];	// full mask/match, to reject words that only
+	uint32_t match[NUM_OPERATIONS]; // agree with an instruction on the indexed bits
+};
+
+static constexpr DecodeTable buildDecodeTable()
+{
+	const uint32_t masks[] = {
+#define RV_MASK(name, format, mask, match, flags) mask,
+		RV32IMA_INSTRUCTIONS(RV_MASK)
+#undef RV_MASK
+	};
+	const uint32_t matches[] = {
+#define RV_MATCH(name, format, mask, match, flags) match,
+		RV32IMA_INSTRUCTIONS(RV_MATCH)
+#undef RV_MATCH
+	};
+
+	DecodeTable t = {};
+	for (uint32_t i = 0; i < DECODE_ENTRIES; i++)
+	{
+		t.op[i] = NOP;
+	}
+	t.mask[NOP] = 0;
+	t.match[NOP] = 0;
+
+	for (uint32_t op = 0; op < NOP; op++)
+	{
+		t.mask[op] = masks[op];
+		t.match[op] = matches[op];
+
+		// fill every index that agrees with the instruction on the bits its mask fixes
+		uint32_t fixed = decodeIndex(masks[op]);
+		uint32_t value = decodeIndex(matches[op]) & fixed;
+		uint32_t free = ~fixed & (DECODE_ENTRIES - 1);
+		uint32_t sub = 0;
+		do
 		{
-			operation = LW;
-		}
+			t.op[value | sub] = op;
+			sub = (sub - free) & free;
+		} while (sub != 0);
+	}
+	return t;
+}
+
+static constexpr DecodeTable decodeTable = buildDecodeTable();
+
+// decode the fields of a raw instruction word without touching the register file
+DecodedInstr CPU::decodeFields(uint32_t instruction)
+{
+	DecodedInstr d;
+
+	Operation op = (Operation)decodeTable.op[decodeIndex(instruction)];
+	if ((instruction & decodeTable.mask[op]) != decodeTable.match[op] || (instruction & 0x3) != 0x3)
+	{
+		// not an RV32IM instruction
+		op = NOP;
+	}
+
+	d.op = op;
+	d.rd = (instruction >> 7) & 0x1F;	// 5 bits
+	d.rs1 = (instruction >> 15) & 0x1F; // 5 bits
+	d.rs2 = (instruction >> 20) & 0x1F; // 5 bits
+	if (d.rd == 0)
+	{
+		d.rd = ZERO_SINK;
+	}
+
+	switch (operationFormat(op))
+	{
+	case FORMAT_R:
+		d.immediate = 0;
+		break;
+	case FORMAT_I:
+		// bits 31-20, sign extended
+		d.immediate = (int32_t)instruction >> 20;
+		break;
+	case FORMAT_S:
+		// bits 31-25 then 11-7
+		d.immediate = ((int32_t)(instruction & 0xFE000000) >> 20) | ((instruction >> 7) & 0x1F);
+		break;
+	case FORMAT_B:
+		d.immediate = ((int32_t)(instruction & 0x80000000) >> 19) | // bit 31 (sign bit) shifted to bit 12
+					  ((instruction & 0x00000080) << 4) |			 // bit 7 shifted to bit 11
+					  ((instruction >> 20) & 0x000007E0) |			 // bits 30-25 shifted to [10:5]
+					  ((instruction >> 7) & 0x0000001E);			 // bits 11-8 shifted to [4:1]
+		break;
+	case FORMAT_U:
+		// bits 31-12, already in place
+		d.immediate = (int32_t)(instruction & 0xFFFFF000);
+		break;
+	case FORMAT_J:
+		d.immediate = ((int32_t)(instruction & 0x80000000) >> 11) | // bit 31 (sign bit) shifted to bit 20
+					  (instruction & 0x000FF000) |					 // bits 19-12
+					  ((instruction >> 9) & 0x00000800) |			 // bit 20 shifted to bit 11
+					  ((instruction >> 20) & 0x000007FE);			 // bits 30-21 shifted to [10:1]
 		break;
-	// store
-	case 0x23:
+	}
+
+	return d;
+}
+
+void CPU::decode(Instruction *curr)
+{
+	DecodedInstr d = decodeFields(curr->instr);
+
+	current = d;
+	operation = d.op;
+	decodeInstr.rs1 = registers[d.rs1];
+	decodeInstr.rs2 = registers[d.rs2];
+	decodeInstr.rd = d.rd;
+	decodeInstr.immediate = d.immediate;
+}
+
+// set the range of PCs holding the program: execution runs while base <= PC <= maxPC
+void CPU::setBounds(unsigned long base, unsigned long maxPC)
+{
+	codeBase = base;
+	endPC = maxPC;
+	decoded.clear();
+	blocks.clear();
+	blockLookup.clear();
+}
+
+// decode the program's instruction memory once so the main loop can skip fetch and decode
+void CPU::predecode(GuestMemory &instMem)
+{
+	unsigned long words = endPC >= codeBase ? (endPC - codeBase) / 4 + 1 : 0;
+	decoded.resize(words);
+	for (unsigned long i = 0; i < words; i++)
 	{
-		if (funct3 == 0x0)
+		decoded[i] = decodeFields(instMem.read32(codeBase + i * 4));
+	}
+}
+
+// fetch and decode in one step from the pre-decoded instruction memory
+void CPU::fetchDecoded()
+{
+	instructionFetch(PC);
+	DecodedInstr d;
+	if ((PC - codeBase) / 4 < decoded.size())
+	{
+		d = decoded[(PC - codeBase) / 4];
+	}
+	else
+	{
+		// outside the decoded program
+		d = decodeFields(0);
+	}
+	PC += 4;
+
+	current = d;
+	operation = d.op;
+	decodeInstr.rs1 = registers[d.rs1];
+	decodeInstr.rs2 = registers[d.rs2];
+	decodeInstr.rd = d.rd;
+	decodeInstr.immediate = d.immediate;
+}
+
+// the operations the engines below treat alike: register-register ALU
+// operations, ALU operations with an immediate, and conditional branches
+#define RV_ALU_REG(X) X(ADD) X(SUB) X(SLL) X(SLT) X(SLTU) X(XOR) X(SRL) X(SRA) X(OR) X(AND) \
+	X(MUL) X(MULH) X(MULHSU) X(MULHU) X(DIV) X(DIVU) X(REM) X(REMU)
+#define RV_ALU_IMM(X) X(ADDI) X(SLTI) X(SLTIU) X(XORI) X(ORI) X(ANDI) X(SLLI) X(SRLI) X(SRAI)
+#define RV_BRANCHES(X) X(BEQ) X(BNE) X(BLT) X(BGE) X(BLTU) X(BGEU)
+#define RV_ATOMICS(X) X(LR_W) X(SC_W) X(AMOSWAP_W) X(AMOADD_W) X(AMOXOR_W) X(AMOAND_W) X(AMOOR_W) \
+	X(AMOMIN_W) X(AMOMAX_W) X(AMOMINU_W) X(AMOMAXU_W)
+
+// alternate engine: runs straight from the pre-decoded instruction memory with a
+// single dispatch per instruction instead of one switch in each of execute,
+// memory and writeback. stops once PC leaves the program, like the main loop,
+// or when stopped. the budget and stop requests are only checked at branches
+// and jumps, so a run can go up to one basic block past maxInstructions.
+// returns the number of instructions executed.
+// uses computed goto where the compiler supports it (gcc/clang).
+unsigned long CPU::runThreaded(unsigned long maxInstructions)
+{
+	// pad with NOPs so every PC up to endPC has a record
+	if (decoded.size() <= (endPC - codeBase) / 4)
+	{
+		decoded.resize((endPC - codeBase) / 4 + 1, decodeFields(0));
+	}
+
+	const DecodedInstr *code = decoded.data();
+	const DecodedInstr *d;
+	const unsigned long base = codeBase;
+	const unsigned long span = endPC - codeBase; // pc - base wraps around when pc < base
+	unsigned long pc = PC;
+	unsigned long blockStart = pc; // first PC of the straight-line run in progress
+	unsigned long executed = 0;	   // instructions before blockStart
+
+#if defined(__GNUC__)
+	// one label per Operation, in enum order
+#define RV_LABEL(name, format, mask, match, flags) &&op_##name,
+	static void *handlers[] = {RV32IMA_INSTRUCTIONS(RV_LABEL) &&op_NOP};
+#undef RV_LABEL
+#define DISPATCH()              \
+	if (pc - base > span)       \
+		goto done;              \
+	d = &code[(pc - base) / 4]; \
+	PROFILE(instruction(pc, d->op)); \
+	instructionFetch(pc);            \
+	goto *handlers[d->op]
+#define HANDLER(name) op_##name:
+#else
+#define DISPATCH() goto next
+#define HANDLER(name) case name:
+#endif
+
+	// a branch or jump to target, ending the straight-line run: count it, then
+	// check the budget and stop requests once for the whole run
+#define TRANSFER(target)                                                      \
+	executed += (pc - blockStart) / 4 + 1;                                    \
+	pc = (target);                                                            \
+	blockStart = pc;                                                          \
+	if (executed >= maxInstructions || stopRequested.load(memory_order_relaxed)) \
+		goto done;                                                            \
+	DISPATCH();
+
+#if !defined(__GNUC__)
+next:
+	if (pc - base > span)
+		goto done;
+	d = &code[(pc - base) / 4];
+	PROFILE(instruction(pc, d->op));
+	instructionFetch(pc);
+	switch (d->op)
+	{
+#else
+	DISPATCH();
+#endif
+
+#define ALU_REG_HANDLER(name)                                                   \
+	HANDLER(name)                                                               \
+	registers[d->rd] = alu(name, registers[d->rs1], registers[d->rs2]);         \
+	pc += 4;                                                                    \
+	DISPATCH();
+#define ALU_IMM_HANDLER(name)                                                   \
+	HANDLER(name)                                                               \
+	registers[d->rd] = alu(immediateBase(name), registers[d->rs1], d->immediate); \
+	pc += 4;                                                                    \
+	DISPATCH();
+#define ATOMIC_HANDLER(name)                                                    \
+	HANDLER(name)                                                               \
+	registers[d->rd] = atomicAccess(name, registers[d->rs1], registers[d->rs2]); \
+	pc += 4;                                                                    \
+	if (stop != STOP_NONE)                                                      \
+		goto done; /* an AMO or SC to the halt address */                       \
+	DISPATCH();
+#define BRANCH_HANDLER(name)                                                    \
+	HANDLER(name)                                                               \
+	{                                                                           \
+		bool taken = branchTaken(name, registers[d->rs1], registers[d->rs2]);   \
+		PROFILE(branch(pc, taken));                                             \
+		TRANSFER(taken ? pc + d->immediate : pc + 4);                           \
+	}
+
+	RV_ALU_REG(ALU_REG_HANDLER)
+	RV_ALU_IMM(ALU_IMM_HANDLER)
+	RV_BRANCHES(BRANCH_HANDLER)
+	RV_ATOMICS(ATOMIC_HANDLER)
+#undef ALU_REG_HANDLER
+#undef ALU_IMM_HANDLER
+#undef ATOMIC_HANDLER
+#undef BRANCH_HANDLER
+
+	HANDLER(LUI)
+	registers[d->rd] = d->immediate;
+	pc += 4;
+	DISPATCH();
+
+	HANDLER(AUIPC)
+	registers[d->rd] = pc + d->immediate;
+	pc += 4;
+	DISPATCH();
+
+	HANDLER(JAL)
+	registers[d->rd] = pc + 4;
+	TRANSFER(pc + d->immediate);
+
+	HANDLER(JALR)
+	{
+		// the target is computed before rd is written, in case rd == rs1
+		unsigned long target = (uint32_t)(registers[d->rs1] + d->immediate) & ~1u;
+		registers[d->rd] = pc + 4;
+		TRANSFER(target);
+	}
+
+	HANDLER(LB)
+	registers[d->rd] = loadByte(registers[d->rs1] + d->immediate);
+	pc += 4;
+	DISPATCH();
+
+	HANDLER(LH)
+	registers[d->rd] = loadHalf(registers[d->rs1] + d->immediate);
+	pc += 4;
+	DISPATCH();
+
+	HANDLER(LW)
+	registers[d->rd] = loadWord(registers[d->rs1] + d->immediate);
+	pc += 4;
+	DISPATCH();
+
+	HANDLER(LBU)
+	registers[d->rd] = loadByteUnsigned(registers[d->rs1] + d->immediate);
+	pc += 4;
+	DISPATCH();
+
+	HANDLER(LHU)
+	registers[d->rd] = loadHalfUnsigned(registers[d->rs1] + d->immediate);
+	pc += 4;
+	DISPATCH();
+
+	HANDLER(SB)
+	storeByte(registers[d->rs1] + d->immediate, registers[d->rs2]);
+	pc += 4;
+	if (stop != STOP_NONE)
+		goto done; // stored to the halt address
+	DISPATCH();
+
+	HANDLER(SH)
+	storeHalf(registers[d->rs1] + d->immediate, registers[d->rs2]);
+	pc += 4;
+	if (stop != STOP_NONE)
+		goto done; // stored to the halt address
+	DISPATCH();
+
+	HANDLER(SW)
+	storeWord(registers[d->rs1] + d->immediate, registers[d->rs2]);
+	pc += 4;
+	if (stop != STOP_NONE)
+		goto done; // stored to the halt address
+	DISPATCH();
+
+	// there is no environment or debugger to hand these to, so they end the program
+	HANDLER(ECALL)
+	HANDLER(EBREAK)
+	stop = STOP_ECALL;
+	pc += 4;
+	goto done;
+
+	// no memory ordering to enforce
+	HANDLER(FENCE)
+	HANDLER(NOP)
+	pc += 4;
+	DISPATCH();
+
+#if !defined(__GNUC__)
+	}
+#endif
+#undef DISPATCH
+#undef HANDLER
+#undef TRANSFER
+
+done:
+	PC = pc;
+	executed += (pc - blockStart) / 4;
+	retiredCount += executed;
+	return executed;
+}
+
+// translate the straight-line code starting at startPC into a new block.
+// PC-relative immediates (AUIPC, branch and JAL targets) are made absolute
+Block *CPU::translateBlock(unsigned long startPC)
+{
+	blocks.push_back(Block());
+	Block *b = &blocks.back();
+	b->startPC = startPC;
+	b->taken = NULL;
+	b->notTaken = NULL;
+
+	for (unsigned long pc = startPC; pc <= endPC; pc += 4)
+	{
+		DecodedInstr d = (pc - codeBase) / 4 < decoded.size() ? decoded[(pc - codeBase) / 4] : decodeFields(0);
+		unsigned flags = operationFlags(d.op);
+
+		if (d.op == AUIPC)
+		{
+			d.op = LUI;
+			d.immediate = pc + d.immediate;
+		}
+		else if ((flags & OP_BRANCH) || d.op == JAL)
 		{
-			operation = SB;
+			d.immediate = pc + d.immediate;
 		}
-		else if (funct3 == 0x2)
+		b->ops.push_back(d);
+
+		if ((flags & (OP_BRANCH | OP_JUMP)) || d.op == ECALL || d.op == EBREAK)
 		{
-			operation = SW;
+			break;
 		}
+	}
 
-		int32_t imm11_5 = instruction & 0xFE000000;
-		int32_t imm4_0 = (instruction & 0xF80) << 13;
-		decodeInstr.immediate = (imm11_5 + imm4_0) >> 20;
+	return b;
+}
 
-		break;
+// find the cached block starting at pc, translating it on first use
+Block *CPU::lookupBlock(unsigned long pc)
+{
+	if (pc > endPC || pc < codeBase)
+	{
+		return NULL;
 	}
-	case 0x63:
+	unsigned long slot = (pc - codeBase) / 4;
+	if (blockLookup.size() <= slot)
 	{
-		operation = BEQ;
+		blockLookup.resize((endPC - codeBase) / 4 + 1, NULL);
+	}
+	if (blockLookup[slot] == NULL || blockLookup[slot]->startPC != pc)
+	{
+		blockLookup[slot] = translateBlock(pc);
+	}
+	return blockLookup[slot];
+}
 
-		int32_t imm12 = (instruction & 0x80000000) >> 19;	// bit 31 (sign bit) shifted to bit 12
-		int32_t imm11 = (instruction & 0x00000080) << 4;	// bit 7 shifted to bit 11
-		int32_t imm10_5 = (instruction & 0x7E000000) >> 20; // bits 30-25 shifted to [10:5]
-		int32_t imm4_1 = (instruction & 0x00000F00) >> 7;	// bits 11-8 shifted to [4:1]
-		int32_t imm0 = 0;
+// alternate engine: runs whole cached blocks from the pre-decoded instruction
+// memory, following chained successors without going back to the lookup.
+// stops after maxInstructions, once PC leaves the program or when stopped
+// (checked between blocks), and returns the number of instructions executed
+unsigned long CPU::runBlocks(unsigned long maxInstructions)
+{
+	unsigned long executed = 0;
+	Block *b = lookupBlock(PC);
+
+	while (b != NULL && executed < maxInstructions && !stopping())
+	{
+		size_t n = b->ops.size();
+		if (maxInstructions - executed < n)
+		{
+			// not enough budget left for the whole block
+			n = maxInstructions - executed;
+		}
 
-		decodeInstr.immediate = imm12 + imm11 + imm10_5 + imm4_1 + imm0;
+		const DecodedInstr *d = b->ops.data();
+		unsigned long pc = b->startPC + 4 * n;
+		Block **next = &b->notTaken;
 
-		// check if sign bit (imm12) is set
-		if (imm12 > 0)
+		if (icache != NULL)
 		{
-			// set upper bits to maintain the sign
-			decodeInstr.immediate = (int32_t)(decodeInstr.immediate | 0xFFFFF000);
+			for (size_t i = 0; i < n; i++)
+			{
+				instructionFetch(b->startPC + 4 * i);
+			}
 		}
 
-		break;
-	}
-	case 0x6F:
-	{
-		operation = JAL;
+		for (size_t i = 0; i < n; i++, d++)
+		{
+			switch (d->op)
+			{
+#define ALU_REG_CASE(name)                                                      \
+			case name:                                                          \
+				registers[d->rd] = alu(name, registers[d->rs1], registers[d->rs2]); \
+				break;
+#define ALU_IMM_CASE(name)                                                      \
+			case name:                                                          \
+				registers[d->rd] = alu(immediateBase(name), registers[d->rs1], d->immediate); \
+				break;
+#define ATOMIC_CASE(name)                                                       \
+			case name:                                                          \
+				registers[d->rd] = atomicAccess(name, registers[d->rs1], registers[d->rs2]); \
+				if (stop != STOP_NONE)                                          \
+				{                                                               \
+					/* an AMO or SC to the halt address: end the block here */  \
+					n = i + 1;                                                  \
+					pc = b->startPC + 4 * n;                                    \
+				}                                                               \
+				break;
+#define BRANCH_CASE(name)                                                       \
+			case name:                                                          \
+			{                                                                   \
+				bool taken = branchTaken(name, registers[d->rs1], registers[d->rs2]); \
+				PROFILE(branch(b->startPC + 4 * i, taken));                     \
+				if (taken)                                                      \
+				{                                                               \
+					pc = d->immediate;                                          \
+					next = &b->taken;                                           \
+				}                                                               \
+				break;                                                          \
+			}
+			RV_ALU_REG(ALU_REG_CASE)
+			RV_ALU_IMM(ALU_IMM_CASE)
+			RV_BRANCHES(BRANCH_CASE)
+			RV_ATOMICS(ATOMIC_CASE)
+#undef ALU_REG_CASE
+#undef ALU_IMM_CASE
+#undef ATOMIC_CASE
+#undef BRANCH_CASE
+			case LUI:
+			case AUIPC: // translated to LUI
+				registers[d->rd] = d->immediate;
+				break;
+			case LB:
+				registers[d->rd] = loadByte(registers[d->rs1] + d->immediate);
+				break;
+			case LH:
+				registers[d->rd] = loadHalf(registers[d->rs1] + d->immediate);
+				break;
+			case LW:
+				registers[d->rd] = loadWord(registers[d->rs1] + d->immediate);
+				break;
+			case LBU:
+				registers[d->rd] = loadByteUnsigned(registers[d->rs1] + d->immediate);
+				break;
+			case LHU:
+				registers[d->rd] = loadHalfUnsigned(registers[d->rs1] + d->immediate);
+				break;
+			case SB:
+				storeByte(registers[d->rs1] + d->immediate, registers[d->rs2]);
+				if (stop != STOP_NONE)
+				{
+					// stored to the halt address: end the block here
+					n = i + 1;
+					pc = b->startPC + 4 * n;
+				}
+				break;
+			case SH:
+				storeHalf(registers[d->rs1] + d->immediate, registers[d->rs2]);
+				if (stop != STOP_NONE)
+				{
+					// stored to the halt address: end the block here
+					n = i + 1;
+					pc = b->startPC + 4 * n;
+				}
+				break;
+			case SW:
+				storeWord(registers[d->rs1] + d->immediate, registers[d->rs2]);
+				if (stop != STOP_NONE)
+				{
+					// stored to the halt address: end the block here
+					n = i + 1;
+					pc = b->startPC + 4 * n;
+				}
+				break;
+			case JAL:
+				registers[d->rd] = pc;
+				pc = d->immediate;
+				next = &b->taken;
+				break;
+			case JALR:
+			{
+				// the target is data, so it cannot be chained
+				unsigned long target = (uint32_t)(registers[d->rs1] + d->immediate) & ~1u;
+				registers[d->rd] = pc;
+				pc = target;
+				next = NULL;
+				break;
+			}
+			case ECALL:
+			case EBREAK:
+				// always the last instruction of its block
+				stop = STOP_ECALL;
+				break;
+			case FENCE:
+			case NOP:
+			case NUM_OPERATIONS:
+				break;
+			}
+		}
 
-		int32_t imm20 = (instruction & 0x80000000) >> 11;	// bit 31 (sign bit) shifted to bit 20
-		int32_t imm10_1 = (instruction & 0x7FE00000) >> 20; // bits 30-21
-		int32_t imm11 = (instruction & 0x00100000) >> 9;	// bit 20 shifted to bit 11
-		int32_t imm19_12 = (instruction & 0x000FF000);		// bits 19-12
-		int32_t imm0 = 0;
+#ifndef NO_PROFILE
+		if (profile != NULL)
+		{
+			// count the block once it has run, to keep the check out of the
+			// inner loop; n is cut short by a halt store, so only what retired
+			for (size_t i = 0; i < n; i++)
+			{
+				profile->instruction(b->startPC + 4 * i, b->ops[i].op);
+			}
+		}
+#endif
+		executed += n;
+		PC = pc;
 
-		decodeInstr.immediate = imm20 + imm10_1 + imm11 + imm19_12 + imm0;
+		if (n < b->ops.size())
+		{
+			// stopped partway through, nothing to chain
+			break;
+		}
 
-		// check if sign bit (imm20) is set
-		if (imm20 > 0)
+		if (next == NULL)
 		{
-			// set upper bits to maintain the sign
-			decodeInstr.immediate = (int32_t)(decodeInstr.immediate | 0xFFF00000);
+			b = lookupBlock(pc);
+			continue;
 		}
 
-		break;
+		// branch targets are fixed, so a successor only has to be looked up once
+		if (*next == NULL)
+		{
+			*next = lookupBlock(pc);
+		}
+		b = *next;
 	}
-	case 0x37:
-		operation = LUI;
-		decodeInstr.immediate = instruction >> 12;
-		break;
+
+	retiredCount += executed;
+	return executed;
+}
+
+// the value an instruction computes in EX: the ALU result, the effective
+// address of a load/store, or the return address of a jump
+static int32_t executeResult(Operation op, int32_t rs1, int32_t rs2, int32_t immediate, unsigned long pc)
+{
+	switch (op)
+	{
+#define ALU_REG_CASE(name) \
+	case name:             \
+		return alu(name, rs1, rs2);
+#define ALU_IMM_CASE(name) \
+	case name:             \
+		return alu(immediateBase(name), rs1, immediate);
+		RV_ALU_REG(ALU_REG_CASE)
+		RV_ALU_IMM(ALU_IMM_CASE)
+#undef ALU_REG_CASE
+#undef ALU_IMM_CASE
+	case LUI:
+		return immediate;
+	case AUIPC:
+		return pc + immediate;
+	case JAL:
+	case JALR:
+		return pc + 4;
+	case LB:
+	case LH:
+	case LW:
+	case LBU:
+	case LHU:
+	case SB:
+	case SH:
+	case SW:
+		return rs1 + immediate;
+#define ATOMIC_CASE(name) case name:
+		RV_ATOMICS(ATOMIC_CASE)
+#undef ATOMIC_CASE
+		return rs1;
 	default:
-		operation = NOP;
-		break;
+		return 0;
 	}
 }
 
 void CPU::execute()
 {
+	unsigned long pc = PC - 4;
 	executeInstr.rs2 = decodeInstr.rs2;
 	executeInstr.rd = decodeInstr.rd;
+	executeInstr.aluResult = executeResult(operation, decodeInstr.rs1, decodeInstr.rs2, decodeInstr.immediate, pc);
+	PROFILE(instruction(pc, operation));
 
-	switch (operation)
+	if (operation == ECALL || operation == EBREAK)
 	{
-	case ADD:
-		executeInstr.aluResult = decodeInstr.rs1 + decodeInstr.rs2;
-		break;
-	case LUI:
-		executeInstr.aluResult = decodeInstr.immediate << 12;
-		break;
-	case ORI:
-		executeInstr.aluResult = decodeInstr.rs1 | decodeInstr.immediate;
-		break;
-	case XOR:
-		executeInstr.aluResult = decodeInstr.rs1 ^ decodeInstr.rs2;
-		break;
-	case SRAI:
-		executeInstr.aluResult = decodeInstr.rs1 >> (decodeInstr.immediate & (unsigned)0x1F);
-		break;
-	case LB:
-	case SB:
-	case LW:
-	case SW:
-		executeInstr.aluResult = decodeInstr.rs1 + decodeInstr.immediate;
-		break;
-	case BEQ:
-		if (decodeInstr.rs1 == decodeInstr.rs2)
+		stop = STOP_ECALL;
+	}
+	if (!(operationFlags(operation) & (OP_BRANCH | OP_JUMP)))
+	{
+		return;
+	}
+	if (operation == JAL)
+	{
+		PC = pc + decodeInstr.immediate;
+	}
+	else if (operation == JALR)
+	{
+		PC = (uint32_t)(decodeInstr.rs1 + decodeInstr.immediate) & ~1u;
+	}
+	else
+	{
+		bool taken = branchTaken(operation, decodeInstr.rs1, decodeInstr.rs2);
+		PROFILE(branch(pc, taken));
+		if (taken)
 		{
-			PC += (int32_t)(decodeInstr.immediate & ~1) - 4;
+			PC = pc + decodeInstr.immediate;
 		}
-		break;
-	case JAL:
-		executeInstr.aluResult = PC;
-		PC += (int32_t)(decodeInstr.immediate & ~1) - 4;
-		break;
-	case NOP:
-		break;
 	}
 }
 
@@ -204,48 +967,475 @@ void CPU::memory()
 	memInstr.rd = executeInstr.rd;
 	memInstr.aluResult = executeInstr.aluResult;
 
-	switch (operation)
+	if (operationFlags(operation) & (OP_LOAD | OP_STORE))
 	{
-	// loads from memory to register
-	case LB:
-		// 8-bit
-		memInstr.dataMem = dmemory[executeInstr.aluResult];
-		break;
-	case LW:
-		// 32-bit
-		memInstr.dataMem = ((((dmemory[executeInstr.aluResult + 3]) << 24)) | ((dmemory[executeInstr.aluResult + 2]) << 16) | ((dmemory[executeInstr.aluResult + 1]) << 8) | (dmemory[executeInstr.aluResult]));
-		break;
-	// stores from register to memory
-	case SB:
-		// 8-bit
-		dmemory[executeInstr.aluResult] = executeInstr.rs2 & 0xFF;
-		break;
-	case SW:
-		// 32-bit
-		dmemory[executeInstr.aluResult] = executeInstr.rs2 & 0xFF;
-		dmemory[executeInstr.aluResult + 1] = ((executeInstr.rs2 & 0xFF00) >> 8);
-		dmemory[executeInstr.aluResult + 2] = ((executeInstr.rs2 & 0xFF0000) >> 16);
-		dmemory[executeInstr.aluResult + 3] = ((executeInstr.rs2 & 0xFF000000) >> 24);
-		break;
-	default:
-		break;
+		memInstr.dataMem = memoryAccess(operation, executeInstr.aluResult, executeInstr.rs2);
 	}
 }
 
 void CPU::writeback()
 {
-	if (operation == SB || operation == SW || operation == NOP)
+	retiredCount++;
+	unsigned flags = operationFlags(operation);
+	if (flags & OP_LOAD)
 	{
-		return;
+		registers[memInstr.rd] = memInstr.dataMem;
 	}
-	else if (operation == LB || operation == LW)
+	else if (flags & OP_RD)
 	{
-		registers[memInstr.rd] = memInstr.dataMem;
+		registers[memInstr.rd] = memInstr.aluResult;
+	}
+}
+
+// fill in what the instruction just through writeback did to the registers
+// and memory (the caller knows its PC and instruction word)
+void CPU::retired(TraceRecord &r)
+{
+	unsigned flags = operationFlags(operation);
+	r.writesRd = (flags & OP_RD) && memInstr.rd != ZERO_SINK;
+	r.rd = memInstr.rd & 0x1F;
+	r.rdValue = registers[r.rd];
+	r.accessesMemory = (flags & (OP_LOAD | OP_STORE)) != 0;
+	r.address = (uint32_t)executeInstr.aluResult;
+}
+
+// the instruction last decoded by decode() or fetchDecoded()
+DecodedInstr CPU::lastDecoded()
+{
+	return current;
+}
+
+// data cache cycles charged since the last call
+uint32_t CPU::takeMemoryLatency()
+{
+	uint32_t latency = memLatency;
+	memLatency = 0;
+	return latency;
+}
+
+// charge data accesses to cache (the caller keeps ownership); NULL makes
+// memory zero-latency again
+void CPU::setDataCache(CacheModel *cache)
+{
+	dcache = cache;
+}
+
+// send data accesses through a coherence protocol shared with other harts,
+// as core number hart (the caller keeps ownership); NULL stops
+void CPU::setCoherence(CoherenceModel *model, unsigned hart)
+{
+	coherence = model;
+	hartId = hart;
+}
+
+// stores to addr stop the program (a tohost-style exit)
+void CPU::setHaltAddress(uint32_t addr)
+{
+	haltAddress = addr;
+}
+
+void CPU::requestStop()
+{
+	stopRequested.store(true, memory_order_relaxed);
+}
+
+// for runners that stop a run themselves, e.g. on a budget
+void CPU::setStopReason(StopReason reason)
+{
+	stop = reason;
+}
+
+// why the last run stopped early, or STOP_NONE if it ran off the end
+StopReason CPU::stopReason()
+{
+	if (stop == STOP_NONE && stopRequested.load(memory_order_relaxed))
+	{
+		return STOP_WATCHDOG;
+	}
+	return stop;
+}
+
+// charge instruction fetch to cache (the caller keeps ownership); NULL makes
+// fetch perfect again. withFetchBuffer keeps the last line fetched, so
+// straight-line code goes to the cache once per line instead of per instruction
+void CPU::setInstructionCache(CacheModel *cache, bool withFetchBuffer)
+{
+	icache = cache;
+	fetchBuffer = withFetchBuffer;
+	fetchLineShift = 0;
+	while (cache != NULL && (1u << fetchLineShift) < cache->lineBytes())
+	{
+		fetchLineShift++;
+	}
+	bufferedLine = ~0ul;
+}
+
+// instructions completed so far, whichever engines ran them
+unsigned long CPU::instructionsRetired()
+{
+	return retiredCount;
+}
+
+unsigned long CPU::fetchBufferHits()
+{
+	return bufferHits;
+}
+
+// cycles the instruction cache has charged (in the pipelined model these are
+// also part of the cycle count)
+unsigned long CPU::fetchStallCycles()
+{
+	return fetchLatency;
+}
+
+// count this run into p (the caller keeps ownership); NULL stops profiling
+void CPU::setProfile(Profile *p)
+{
+	profile = p;
+}
+
+// which operations write rd and read rs1/rs2, for hazard detection
+static bool writesRd(Operation op)
+{
+	return operationFlags(op) & OP_RD;
+}
+
+static bool readsRs1(Operation op)
+{
+	return operationFlags(op) & OP_RS1;
+}
+
+static bool readsRs2(Operation op)
+{
+	return operationFlags(op) & OP_RS2;
+}
+
+static bool isLoad(Operation op)
+{
+	return operationFlags(op) & OP_LOAD;
+}
+
+// empty every pipeline latch and clear the cycle counts
+void CPU::resetPipeline()
+{
+	ifid.valid = false;
+	ifid.bubbleCounted = false;
+	idex.valid = false;
+	exmem.valid = false;
+	memwb.valid = false;
+	pipeStats.cycles = 0;
+	pipeStats.instructions = 0;
+	pipeStats.loadUseStalls = 0;
+	pipeStats.flushCycles = 0;
+	pipeStats.branches = 0;
+	pipeStats.mispredicts = 0;
+	pipeStats.predictorStalls = 0;
+	pipeStats.memoryStalls = 0;
+	pipeStats.fetchStalls = 0;
+	predictionPending = false;
+	memLatency = 0;
+	memStallRemaining = 0;
+	fetchStallRemaining = 0;
+	fetchCharged = false;
+}
+
+// use bp (any ca2 branch_predictor) to steer fetch in the pipelined model.
+// the caller keeps ownership
+void CPU::setBranchPredictor(branch_predictor *bp)
+{
+	predictor = bp;
+}
+
+// advance the 5-stage pipeline by one clock cycle. stages are evaluated from
+// writeback back to fetch so each reads the latch contents from the previous
+// cycle. results are forwarded from MEM and WB into EX, and a load followed by
+// a dependent instruction stalls decode for one cycle. fetch follows the branch
+// predictor (or assumes not taken without one); branches and jumps resolve in
+// EX and flush the two younger instructions when fetch went the wrong way.
+// returns false once the program has left [codeBase, endPC] and the pipeline
+// has drained
+bool CPU::cycle(GuestMemory &instMem)
+{
+	bool fetching = PC >= codeBase && PC <= endPC && stop == STOP_NONE;
+	if (!fetching && !ifid.valid && !idex.valid && !exmem.valid && !memwb.valid)
+	{
+		return false;
+	}
+	pipeStats.cycles++;
+
+	if (memStallRemaining > 0)
+	{
+		// a data cache miss holds every stage
+		memStallRemaining--;
+		pipeStats.memoryStalls++;
+		return true;
+	}
+
+	// writeback (first half of the cycle, so decode sees the new value)
+	if (memwb.valid)
+	{
+		if (writesRd(memwb.op))
+		{
+			registers[memwb.v.rd] = isLoad(memwb.op) ? memwb.v.dataMem : memwb.v.aluResult;
+		}
+		pipeStats.instructions++;
+		retiredCount++;
+	}
+
+	// memory
+	MemoryLatch nextMemwb;
+	nextMemwb.valid = exmem.valid;
+	memLatency = 0;
+	if (exmem.valid)
+	{
+		nextMemwb.op = exmem.op;
+		nextMemwb.v.rd = exmem.v.rd;
+		nextMemwb.v.aluResult = exmem.v.aluResult;
+		nextMemwb.v.dataMem = 0;
+
+		if (operationFlags(exmem.op) & (OP_LOAD | OP_STORE))
+		{
+			nextMemwb.v.dataMem = memoryAccess(exmem.op, exmem.v.aluResult, exmem.v.rs2);
+		}
+	}
+
+	// the access completes now, but everything waits out the miss penalty first
+	memStallRemaining = memLatency;
+
+	if (stop != STOP_NONE)
+	{
+		// a store to the halt address: nothing younger completes
+		if (idex.valid && idex.prediction != NULL)
+		{
+			predictionPending = false;
+		}
+		idex.valid = false;
+	}
+
+	// execute, taking operands forwarded from the instructions now in MEM and WB
+	ExecuteLatch nextExmem;
+	nextExmem.valid = idex.valid;
+	bool redirect = false;
+	unsigned long target = 0;
+	if (idex.valid)
+	{
+		int32_t rs1 = idex.v.rs1;
+		int32_t rs2 = idex.v.rs2;
+		int32_t wbValue = memwb.valid && isLoad(memwb.op) ? memwb.v.dataMem : memwb.v.aluResult;
+
+		if (exmem.valid && writesRd(exmem.op) && exmem.v.rd == idex.rs1Reg)
+			rs1 = exmem.v.aluResult;
+		else if (memwb.valid && writesRd(memwb.op) && memwb.v.rd == idex.rs1Reg)
+			rs1 = wbValue;
+
+		if (exmem.valid && writesRd(exmem.op) && exmem.v.rd == idex.rs2Reg)
+			rs2 = exmem.v.aluResult;
+		else if (memwb.valid && writesRd(memwb.op) && memwb.v.rd == idex.rs2Reg)
+			rs2 = wbValue;
+
+		PROFILE(instruction(idex.pc, idex.op));
+		if (idex.op == ECALL || idex.op == EBREAK)
+		{
+			stop = STOP_ECALL;
+		}
+		nextExmem.op = idex.op;
+		nextExmem.v.rd = idex.v.rd;
+		nextExmem.v.rs2 = rs2;
+		nextExmem.v.aluResult = executeResult(idex.op, rs1, rs2, idex.v.immediate, idex.pc);
+
+		unsigned flags = operationFlags(idex.op);
+		if (flags & (OP_BRANCH | OP_JUMP))
+		{
+			bool taken = (flags & OP_JUMP) || branchTaken(idex.op, rs1, rs2);
+			unsigned long branchTarget = idex.op == JALR ? (uint32_t)(rs1 + idex.v.immediate) & ~1u : idex.pc + idex.v.immediate;
+			unsigned long actual = taken ? branchTarget : idex.pc + 4;
+			unsigned long fetched = idex.predictedTaken ? idex.pc + idex.v.immediate : idex.pc + 4;
+
+			pipeStats.branches++;
+			if (flags & OP_BRANCH)
+			{
+				PROFILE(branch(idex.pc, taken));
+			}
+			if (actual != fetched)
+			{
+				pipeStats.mispredicts++;
+				redirect = true;
+				target = actual;
+			}
+			if (idex.prediction != NULL)
+			{
+				predictor->update(idex.prediction, taken, branchTarget);
+				predictionPending = false;
+			}
+		}
+	}
+
+	if (stop != STOP_NONE)
+	{
+		// ECALL/EBREAK (or a halt store): drop the younger instructions and
+		// let the older ones drain
+		if (ifid.valid && ifid.prediction != NULL)
+		{
+			predictionPending = false;
+		}
+		ifid.valid = false;
+		fetching = false;
+	}
+
+	// decode, holding the instruction if it needs a load that is still in EX
+	DecodeLatch nextIdex;
+	nextIdex.valid = false;
+	bool stall = false;
+	if (ifid.valid)
+	{
+		DecodedInstr d = decodeFields(ifid.instr);
+
+		if (idex.valid && isLoad(idex.op) &&
+			((readsRs1(d.op) && d.rs1 == idex.v.rd) || (readsRs2(d.op) && d.rs2 == idex.v.rd)))
+		{
+			stall = true;
+		}
+		else
+		{
+			nextIdex.valid = true;
+			nextIdex.pc = ifid.pc;
+			nextIdex.predictedTaken = ifid.predictedTaken;
+			nextIdex.prediction = ifid.prediction;
+			nextIdex.op = d.op;
+			nextIdex.rs1Reg = d.rs1;
+			nextIdex.rs2Reg = d.rs2;
+			nextIdex.v.rs1 = registers[d.rs1];
+			nextIdex.v.rs2 = registers[d.rs2];
+			nextIdex.v.rd = d.rd;
+			nextIdex.v.immediate = d.immediate;
+		}
+	}
+
+	// fetch
+	if (redirect)
+	{
+		// the instructions in IF and ID came from the wrong path: this cycle's
+		// fetch is lost, and so is the slot in ID unless it was a bubble whose
+		// cycle a stall already counted. a branch
+		// among them never reaches EX, so its prediction is dropped here
+		if ((nextIdex.valid && nextIdex.prediction != NULL) || (ifid.valid && ifid.prediction != NULL))
+		{
+			predictionPending = false;
+		}
+		pipeStats.flushCycles += ifid.valid || !ifid.bubbleCounted ? 2 : 1;
+		nextIdex.valid = false;
+		ifid.valid = false;
+		ifid.bubbleCounted = true;
+		PC = target;
+		// a miss on the wrong path is abandoned (the line stays filled)
+		fetchStallRemaining = 0;
+		fetchCharged = false;
+	}
+	else if (stall)
+	{
+		// keep the same instruction in IF/ID and send a bubble into EX
+		pipeStats.loadUseStalls++;
+	}
+	else if (fetching && fetchStallRemaining > 0)
+	{
+		// still waiting for the instruction cache
+		fetchStallRemaining--;
+		pipeStats.fetchStalls++;
+		ifid.valid = false;
+		ifid.bubbleCounted = true;
+	}
+	else if (fetching && !fetchCharged && (fetchStallRemaining = instructionFetch(PC)) > 0)
+	{
+		// instruction cache miss: this cycle is the first one spent waiting
+		fetchCharged = true;
+		fetchStallRemaining--;
+		pipeStats.fetchStalls++;
+		ifid.valid = false;
+		ifid.bubbleCounted = true;
+	}
+	else if (fetching)
+	{
+		uint32_t instr = instMem.read32(PC);
+		DecodedInstr d = decodeFields(instr);
+		// JALR targets come from a register, so fetch just carries on past them
+		bool isBranch = (operationFlags(d.op) & OP_BRANCH) || d.op == JAL;
+
+		if (isBranch && predictor != NULL && predictionPending)
+		{
+			// branch_predictor keeps the last prediction in its own state, so
+			// only one branch can sit between predict and update at a time.
+			// the fetch has been charged, so the cache is not asked again
+			fetchCharged = true;
+			ifid.valid = false;
+			ifid.bubbleCounted = true;
+			pipeStats.predictorStalls++;
+		}
+		else
+		{
+			fetchCharged = false;
+			ifid.valid = true;
+			ifid.pc = PC;
+			ifid.instr = instr;
+			ifid.predictedTaken = false;
+			ifid.prediction = NULL;
+
+			if (isBranch && predictor != NULL)
+			{
+				branch_info bi;
+				bi.address = PC;
+				bi.opcode = 0;
+				bi.br_flags = d.op != JAL ? BR_CONDITIONAL : (d.rd == 1 ? BR_CALL : 0);
+
+				ifid.prediction = predictor->predict(bi);
+				ifid.predictedTaken = ifid.prediction->direction_prediction();
+				predictionPending = true;
+			}
+
+			if (ifid.predictedTaken)
+			{
+				// the target comes straight out of the instruction, as a BTB would supply it
+				PC += d.immediate;
+			}
+			else
+			{
+				PC += 4;
+			}
+		}
 	}
 	else
 	{
-		registers[memInstr.rd] = memInstr.aluResult;
+		ifid.valid = false;
+		ifid.bubbleCounted = false;
 	}
+
+	idex = nextIdex;
+	exmem = nextExmem;
+	memwb = nextMemwb;
+	return true;
+}
+
+PipelineStats CPU::pipelineStats()
+{
+	return pipeStats;
+}
+
+// print the pipelined model's cycle breakdown (to stderr, so the register
+// output stays the only thing on stdout)
+void CPU::printPipelineStats()
+{
+	unsigned long other = pipeStats.cycles - pipeStats.instructions - pipeStats.loadUseStalls - pipeStats.flushCycles - pipeStats.predictorStalls - pipeStats.memoryStalls - pipeStats.fetchStalls;
+	double cpi = pipeStats.instructions ? (double)pipeStats.cycles / pipeStats.instructions : 0;
+
+	cerr << "cycles: " << pipeStats.cycles << endl;
+	cerr << "instructions: " << pipeStats.instructions << endl;
+	cerr << "CPI: " << fixed << setprecision(3) << cpi << endl;
+	cerr << "load-use stall cycles: " << pipeStats.loadUseStalls << endl;
+	cerr << "branch flush cycles: " << pipeStats.flushCycles << endl;
+	cerr << "branch mispredictions: " << pipeStats.mispredicts << " / " << pipeStats.branches << endl;
+	cerr << "predictor stall cycles: " << pipeStats.predictorStalls << endl;
+	cerr << "data cache stall cycles: " << pipeStats.memoryStalls << endl;
+	cerr << "instruction cache stall cycles: " << pipeStats.fetchStalls << endl;
+	cerr << "fill/drain cycles: " << other << endl;
 }
 
 // read the current PC
@@ -254,6 +1444,32 @@ unsigned long CPU::readPC()
 	return PC;
 }
 
+// start execution somewhere other than 0 (e.g. an ELF entry point)
+void CPU::setPC(unsigned long pc)
+{
+	PC = pc;
+}
+
+int32_t CPU::readReg(int reg)
+{
+	return registers[reg];
+}
+
+// set an initial register value before the program runs
+void CPU::setReg(int reg, int32_t value)
+{
+	if (reg != 0)
+	{
+		registers[reg] = value;
+	}
+}
+
+// data memory, for loaders that place initialised data
+GuestMemory &CPU::dataMemory()
+{
+	return dmemory;
+}
+
 // print registers
 void CPU::printRegs()
 {
@@ -1,40 +1,92 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include "GuestMemory.h"
+#include "ISA.h"
+#include "Profile.h"
+#include "Trace.h"
+#include "Cache.h"
+#include "Coherence.h"
+#include "../ca2/src/branch.h"
+#include "../ca2/src/predictor.h"
+
+#include <atomic>
 #include <iostream>
 #include <bitset>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
+#include <vector>
+#include <deque>
 using namespace std;
 
-enum Operation
+// writes to x0 are steered to this extra register at decode time, so x0 stays
+// zero without any engine having to check for it
+const int ZERO_SINK = 32;
+
+// an instruction decoded once when the program is loaded, so the main loop
+// does not have to rebuild and re-decode the same bits on every pass
+struct DecodedInstr
+{
+	Operation op;
+	uint8_t rd; // ZERO_SINK when the instruction names x0
+	uint8_t rs1;
+	uint8_t rs2;
+	int32_t immediate;
+};
+
+// a straight-line run of instructions ending at a branch or jump (or the end of the
+// program), translated once and cached by its starting PC
+struct Block
+{
+	unsigned long startPC;
+	vector<DecodedInstr> ops; // AUIPC turned into LUI, branch/JAL immediates turned into absolute targets
+	Block *taken;			  // chained successor when the final branch is taken (or JAL); JALR is never chained
+	Block *notTaken;		  // chained successor on fall-through
+};
+
+// cycle accounting from the pipelined model
+struct PipelineStats
 {
-	ADD,
-	LUI,
-	ORI,
-	XOR,
-	SRAI,
-	LB,
-	LW,
-	SB,
-	SW,
-	BEQ,
-	JAL,
-	NOP
+	unsigned long cycles;
+	unsigned long instructions;	 // retired through writeback
+	unsigned long loadUseStalls; // cycles decode was held behind a load
+	unsigned long flushCycles;	 // fetch slots thrown away after a mispredicted branch/jump
+	unsigned long branches;		 // branches and jumps resolved in execute
+	unsigned long mispredicts;	 // of those, how many fetch got wrong
+	unsigned long predictorStalls; // fetch cycles held because the predictor was still waiting for an update
+	unsigned long memoryStalls;	   // cycles the whole pipeline waited on the data cache
+	unsigned long fetchStalls;	   // cycles fetch waited on the instruction cache
 };
 
+// why a run stopped before PC left the program
+enum StopReason
+{
+	STOP_NONE,
+	STOP_ECALL,		   // the program executed ECALL or EBREAK
+	STOP_HALT_ADDRESS, // the program stored to the halt address
+	STOP_INSTRUCTION_LIMIT,
+	STOP_CYCLE_LIMIT,
+	STOP_WATCHDOG
+};
+
+const char *stopReasonName(StopReason reason);
+
 class Instruction
 {
 public:
-	bitset<32> instr;			   // instruction
-	Instruction(bitset<32> fetch); // constructor
+	uint32_t instr;				 // raw instruction word
+	Instruction(uint32_t fetch); // constructor
 };
 
 class CPU
 {
 private:
-	int dmemory[4096];	   // data memory byte addressable in little endian fashion;
+	GuestMemory dmemory;   // data memory byte addressable in little endian fashion, paged in on first touch
 	unsigned long PC;	   // pc
-	int32_t registers[32]; // general-purpose registers (RISC-V has 32)
+	int32_t registers[33]; // general-purpose registers (RISC-V has 32), plus ZERO_SINK
 	Operation operation;
+	DecodedInstr current; // decoded form of the instruction in the stage loop
 
 	struct Decode
 	{
@@ -58,13 +110,142 @@ private:
 		int32_t dataMem;
 	} memInstr;
 
+	// latches between the stages of the pipelined model; each one holds the
+	// instruction that will enter the next stage on the following cycle
+	struct FetchLatch
+	{
+		bool valid;
+		unsigned long pc;
+		uint32_t instr;
+		bool predictedTaken;
+		branch_update *prediction; // from the branch predictor, handed back on update
+		bool bubbleCounted;		   // when empty: its cycle was already charged to a stall or flush
+	} ifid;
+
+	struct DecodeLatch
+	{
+		bool valid;
+		unsigned long pc;
+		bool predictedTaken;
+		branch_update *prediction;
+		Operation op;
+		uint8_t rs1Reg; // source register numbers, for forwarding
+		uint8_t rs2Reg;
+		Decode v;
+	} idex;
+
+	struct ExecuteLatch
+	{
+		bool valid;
+		Operation op;
+		Execute v;
+	} exmem;
+
+	struct MemoryLatch
+	{
+		bool valid;
+		Operation op;
+		Memory v;
+	} memwb;
+
+	PipelineStats pipeStats;
+	branch_predictor *predictor; // fetch-stage predictor; NULL predicts every branch/JAL not taken
+	bool predictionPending;		 // a predicted branch has not been resolved (and updated) yet
+
+	Profile *profile; // counters for this run, or NULL when not profiling
+
+	CacheModel *dcache;			  // data cache timing, or NULL for zero-latency memory
+	uint32_t memLatency;		  // cycles charged by the data cache since the pipeline last looked
+	uint32_t memStallRemaining;	  // cycles the pipeline still has to wait for MEM
+
+	CoherenceModel *coherence; // MOESIF protocol shared with the other harts, or NULL
+	unsigned hartId;		   // this CPU's core number in the protocol
+
+	bool reservationValid; // LR/SC reservation
+	int32_t reservedAddress;
+	int32_t reservedValue; // what LR read; SC succeeds only if the word still holds it
+
+	CacheModel *icache;			  // instruction cache timing, or NULL for perfect fetch
+	bool fetchBuffer;			  // fetch holds a whole line, so only a new line goes to the cache
+	uint32_t fetchLineShift;
+	unsigned long bufferedLine;	  // line held in the fetch buffer (~0 when empty)
+	unsigned long bufferHits;	  // fetches served from the fetch buffer
+	unsigned long fetchLatency;	  // cycles charged by the instruction cache so far
+	uint32_t fetchStallRemaining; // cycles the pipeline's fetch still waits on a miss
+	bool fetchCharged;			  // the fetch of the instruction at PC has already been charged (hit or miss)
+
+	unsigned long retiredCount; // instructions completed on any engine (RISC-V instret)
+
+	StopReason stop;			// set by ECALL/EBREAK, a halt store or the runner's budget checks
+	uint64_t haltAddress;		// a store here halts the program (beyond 32 bits when unset)
+	atomic<bool> stopRequested; // set from another thread, e.g. by a watchdog
+
+	unsigned long codeBase; // first PC of the program
+	unsigned long endPC;	// last PC of the program; execution stops once PC leaves [codeBase, endPC]
+
+	vector<DecodedInstr> decoded; // pre-decoded instruction memory, one record per word from codeBase
+
+	deque<Block> blocks;		 // translated basic blocks (deque keeps chain pointers stable)
+	vector<Block *> blockLookup; // block cache keyed by PC / 4
+
+	static DecodedInstr decodeFields(uint32_t instruction);
+	uint32_t load(int32_t addr, uint32_t bytes);
+	void store(int32_t addr, uint32_t bytes, int32_t value);
+	int32_t loadByte(int32_t addr);
+	int32_t loadByteUnsigned(int32_t addr);
+	int32_t loadHalf(int32_t addr);
+	int32_t loadHalfUnsigned(int32_t addr);
+	int32_t loadWord(int32_t addr);
+	void storeByte(int32_t addr, int32_t value);
+	void storeHalf(int32_t addr, int32_t value);
+	void storeWord(int32_t addr, int32_t value);
+	int32_t memoryAccess(Operation op, int32_t addr, int32_t value);
+	int32_t atomicAccess(Operation op, int32_t addr, int32_t value);
+	Block *translateBlock(unsigned long startPC);
+	Block *lookupBlock(unsigned long pc);
+	uint32_t instructionFetch(unsigned long pc);
+	uint32_t cachedFetch(unsigned long pc);
+	bool stopping();
+
 public:
 	CPU();
 	unsigned long readPC();
-	bitset<32> fetch(bitset<8> *instMem);
+	void setPC(unsigned long pc);
+	int32_t readReg(int reg);
+	void setReg(int reg, int32_t value);
+	GuestMemory &dataMemory();
+	uint32_t fetch(GuestMemory &instMem);
 	void decode(Instruction *curr);
+	void setBounds(unsigned long base, unsigned long maxPC);
+	void predecode(GuestMemory &instMem);
+	void fetchDecoded();
+	unsigned long runThreaded(unsigned long maxInstructions);
+	unsigned long runBlocks(unsigned long maxInstructions);
 	void execute();
 	void memory();
 	void writeback();
+	void retired(TraceRecord &r);
+	DecodedInstr lastDecoded();
+	uint32_t takeMemoryLatency();
+	void resetPipeline();
+	void setBranchPredictor(branch_predictor *bp);
+	void setProfile(Profile *p);
+	void setDataCache(CacheModel *cache);
+	void setInstructionCache(CacheModel *cache, bool withFetchBuffer);
+	void setCoherence(CoherenceModel *model, unsigned hart);
+	void setHaltAddress(uint32_t addr);
+	void requestStop(); // safe to call from any thread; the engines notice at the next block
+	void setStopReason(StopReason reason);
+	StopReason stopReason();
+	unsigned long instructionsRetired();
+	unsigned long fetchBufferHits();
+	unsigned long fetchStallCycles();
+	bool cycle(GuestMemory &instMem);
+	PipelineStats pipelineStats();
+	bool saveCheckpoint(const char *path, string &error);	 // PC, registers, data memory and pipeline latches
+	bool restoreCheckpoint(const char *path, string &error); // onto the same program, already loaded
+	void printPipelineStats();
 	void printRegs();
 };
+
+#endif
@@ -0,0 +1,220 @@
+#include "Cache.h"
+
+#include <cstdlib>
+#include <iomanip>
+#include <sstream>
+
+static bool powerOfTwo(uint32_t v)
+{
+	return v != 0 && (v & (v - 1)) == 0;
+}
+
+static uint32_t log2of(uint32_t v)
+{
+	uint32_t n = 0;
+	while ((1u << n) < v)
+	{
+		n++;
+	}
+	return n;
+}
+
+bool parseCacheConfig(const string &spec, CacheConfig &config, string &error)
+{
+	stringstream ss(spec);
+	string item;
+	while (getline(ss, item, ','))
+	{
+		if (item.empty() || item == "default")
+			continue;
+
+		size_t eq = item.find('=');
+		if (eq == string::npos)
+		{
+			error = "bad cache option " + item;
+			return false;
+		}
+		string key = item.substr(0, eq);
+		string value = item.substr(eq + 1);
+		char *end;
+		unsigned long n = strtoul(value.c_str(), &end, 0);
+		if (*end == 'K' || *end == 'k')
+			n *= 1024;
+		else if (*end == 'M' || *end == 'm')
+			n *= 1024 * 1024;
+
+		if (key == "size")
+			config.sizeBytes = n;
+		else if (key == "ways")
+			config.ways = n;
+		else if (key == "line")
+			config.lineBytes = n;
+		else if (key == "miss")
+			config.missPenalty = n;
+		else if (key == "wpen")
+			config.writePenalty = n;
+		else if (key == "policy" && (value == "lru" || value == "plru"))
+			config.pseudoLRU = value == "plru";
+		else if (key == "write" && (value == "wb" || value == "wt"))
+			config.writeBack = value == "wb";
+		else
+		{
+			error = "bad cache option " + item;
+			return false;
+		}
+	}
+
+	if (!powerOfTwo(config.sizeBytes) || !powerOfTwo(config.ways) || !powerOfTwo(config.lineBytes) || config.lineBytes < 4 ||
+		config.ways > 64 || (uint64_t)config.ways * config.lineBytes > config.sizeBytes)
+	{
+		error = "cache size, ways and line must be powers of two with ways * line <= size (and ways <= 64)";
+		return false;
+	}
+	return true;
+}
+
+CacheModel::CacheModel(const CacheConfig &c) : config(c)
+{
+	uint32_t sets = config.sizeBytes / (config.ways * config.lineBytes);
+	lineShift = log2of(config.lineBytes);
+	setMask = sets - 1;
+	tags.assign(sets * config.ways, 0);
+	dirty.assign(sets * config.ways, 0);
+	if (config.pseudoLRU)
+		trees.assign(sets, 0);
+	else
+		stamps.assign(sets * config.ways, 0);
+	clock = 0;
+
+	counts.reads = 0;
+	counts.writes = 0;
+	counts.readMisses = 0;
+	counts.writeMisses = 0;
+	counts.writebacks = 0;
+	counts.stallCycles = 0;
+}
+
+// mark way as the most recently used in set
+inline void CacheModel::touch(uint32_t set, uint32_t way)
+{
+	if (!config.pseudoLRU)
+	{
+		stamps[set * config.ways + way] = ++clock;
+		return;
+	}
+
+	// walk from the root to the leaf for way, pointing every node away from it
+	uint64_t &tree = trees[set];
+	uint32_t node = 0;
+	for (uint32_t half = config.ways / 2; half > 0; half /= 2)
+	{
+		bool right = (way & half) != 0;
+		if (right)
+			tree &= ~(1ull << node);
+		else
+			tree |= 1ull << node;
+		node = 2 * node + 1 + right;
+	}
+}
+
+// the way to replace in set: an invalid one if there is any, otherwise the LRU
+// (or the one the pseudo-LRU tree points at)
+uint32_t CacheModel::victim(uint32_t set)
+{
+	uint32_t first = set * config.ways;
+	for (uint32_t w = 0; w < config.ways; w++)
+	{
+		if (!(tags[first + w] & VALID))
+			return w;
+	}
+
+	if (!config.pseudoLRU)
+	{
+		uint32_t oldest = 0;
+		for (uint32_t w = 1; w < config.ways; w++)
+		{
+			if (stamps[first + w] < stamps[first + oldest])
+				oldest = w;
+		}
+		return oldest;
+	}
+
+	uint64_t tree = trees[set];
+	uint32_t node = 0;
+	uint32_t way = 0;
+	for (uint32_t half = config.ways / 2; half > 0; half /= 2)
+	{
+		bool right = (tree >> node) & 1;
+		if (right)
+			way |= half;
+		node = 2 * node + 1 + right;
+	}
+	return way;
+}
+
+uint32_t CacheModel::access(uint32_t line, bool isWrite)
+{
+	uint32_t set = line & setMask;
+	uint32_t first = set * config.ways;
+	uint32_t tag = (line << 1) | VALID;
+
+	for (uint32_t w = 0; w < config.ways; w++)
+	{
+		if (tags[first + w] == tag)
+		{
+			touch(set, w);
+			if (!isWrite)
+				return 0;
+			if (config.writeBack)
+			{
+				dirty[first + w] = 1;
+				return 0;
+			}
+			counts.writebacks++;
+			return config.writePenalty;
+		}
+	}
+
+	// miss
+	if (isWrite)
+	{
+		counts.writeMisses++;
+		if (!config.writeBack)
+		{
+			// no-allocate: the write goes straight to memory
+			counts.writebacks++;
+			return config.writePenalty;
+		}
+	}
+	else
+	{
+		counts.readMisses++;
+	}
+
+	uint32_t way = victim(set);
+	uint32_t cost = config.missPenalty;
+	if (dirty[first + way])
+	{
+		counts.writebacks++;
+		cost += config.writePenalty;
+	}
+	tags[first + way] = tag;
+	dirty[first + way] = isWrite;
+	touch(set, way);
+	return cost;
+}
+
+void CacheModel::printStats(ostream &out, const char *name)
+{
+	uint64_t accesses = counts.reads + counts.writes;
+	uint64_t misses = counts.readMisses + counts.writeMisses;
+	double rate = accesses ? 100.0 * misses / accesses : 0;
+
+	out << name << ": " << config.sizeBytes / 1024 << "KB " << config.ways << "-way " << config.lineBytes << "B lines, "
+		<< (config.pseudoLRU ? "pseudo-LRU" : "LRU") << ", " << (config.writeBack ? "write-back" : "write-through") << endl;
+	out << name << " reads: " << counts.reads << " (" << counts.readMisses << " misses)" << endl;
+	out << name << " writes: " << counts.writes << " (" << counts.writeMisses << " misses)" << endl;
+	out << name << " miss rate: " << fixed << setprecision(2) << rate << "%" << endl;
+	out << name << " writebacks: " << counts.writebacks << endl;
+	out << name << " stall cycles: " << counts.stallCycles << endl;
+}
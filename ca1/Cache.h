@@ -0,0 +1,97 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+struct CacheConfig
+{
+	uint32_t sizeBytes;
+	uint32_t ways;
+	uint32_t lineBytes;
+	bool pseudoLRU;			 // tree pseudo-LRU instead of true LRU
+	bool writeBack;			 // write-back + write-allocate, otherwise write-through + no-allocate
+	uint32_t missPenalty;	 // cycles to fill a line from memory
+	uint32_t writePenalty;	 // cycles for a write reaching memory (dirty eviction or write-through)
+
+	CacheConfig() : sizeBytes(32 * 1024), ways(8), lineBytes(64), pseudoLRU(false), writeBack(true), missPenalty(20), writePenalty(10) {}
+};
+
+// parse "size=32K,ways=8,line=64,policy=lru|plru,write=wb|wt,miss=20,wpen=10"
+// (any subset, the rest keep their defaults; "default" alone is fine too).
+// sizes, ways and line length must be powers of two
+bool parseCacheConfig(const string &spec, CacheConfig &config, string &error);
+
+struct CacheStats
+{
+	uint64_t reads;
+	uint64_t writes;
+	uint64_t readMisses;
+	uint64_t writeMisses;
+	uint64_t writebacks;  // dirty lines evicted (write-back) or writes sent on (write-through)
+	uint64_t stallCycles; // total latency charged
+};
+
+// timing model of a set-associative cache. it only tracks tags, so the data
+// itself stays in the backing GuestMemory; each access returns the extra
+// cycles it costs over a hit. tags for a set sit next to each other, with the
+// valid bit folded into the stored tag, so a lookup is one short scan
+class CacheModel
+{
+public:
+	CacheModel(const CacheConfig &config);
+
+	uint32_t read(uint32_t addr, uint32_t bytes);
+	uint32_t write(uint32_t addr, uint32_t bytes);
+
+	uint32_t lineBytes() const { return config.lineBytes; }
+	const CacheStats &stats() const { return counts; }
+	void printStats(ostream &out, const char *name);
+
+private:
+	static const uint32_t VALID = 1; // low bit of a stored tag; real tags are line addresses, so it is free
+
+	CacheConfig config;
+	uint32_t lineShift;
+	uint32_t setMask;
+	vector<uint32_t> tags;	 // sets * ways, line address | VALID
+	vector<uint8_t> dirty;	 // sets * ways
+	vector<uint64_t> stamps; // LRU: last use of each line
+	vector<uint64_t> trees;	 // pseudo-LRU: one bit per internal node, per set
+	uint64_t clock;
+	CacheStats counts;
+
+	uint32_t access(uint32_t line, bool isWrite);
+	void touch(uint32_t set, uint32_t way);
+	uint32_t victim(uint32_t set);
+};
+
+inline uint32_t CacheModel::read(uint32_t addr, uint32_t bytes)
+{
+	counts.reads++;
+	uint32_t cost = access(addr >> lineShift, false);
+	if (((addr + bytes - 1) >> lineShift) != (addr >> lineShift))
+	{
+		// unaligned access straddling two lines
+		cost += access((addr + bytes - 1) >> lineShift, false);
+	}
+	counts.stallCycles += cost;
+	return cost;
+}
+
+inline uint32_t CacheModel::write(uint32_t addr, uint32_t bytes)
+{
+	counts.writes++;
+	uint32_t cost = access(addr >> lineShift, true);
+	if (((addr + bytes - 1) >> lineShift) != (addr >> lineShift))
+	{
+		cost += access((addr + bytes - 1) >> lineShift, true);
+	}
+	counts.stallCycles += cost;
+	return cost;
+}
+
+#endif
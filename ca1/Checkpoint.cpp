@@ -0,0 +1,354 @@
+#include "CPU.h"
+
+#include <cstdio>
+
+// checkpoint file layout, every field a little-endian 32-bit word unless noted:
+//   "RVCK", version
+//   codeBase, endPC (a checkpoint only restores onto the same program)
+//   PC, registers[32]
+//   reference engine: operation, decode (rs1, rs2, rd, immediate),
+//                     execute (aluResult, rs2, rd), memory (rd, aluResult, dataMem)
+//   pipeline: IF/ID, ID/EX, EX/MEM, MEM/WB latches (IF/ID with whether its
+//             bubble was counted), cycles left on a data cache miss and on
+//             an instruction cache miss (and whether it was already
+//             charged), then the cycle counts (64-bit)
+//   instructions retired (64-bit), LR/SC reservation (valid, address, value)
+//   data memory: page count, then each non-zero page as its address + 4KB
+static const char CHECKPOINT_MAGIC[4] = {'R', 'V', 'C', 'K'};
+static const uint32_t CHECKPOINT_VERSION = 6;
+
+static void put32(FILE *f, uint32_t v)
+{
+	uint8_t b[4] = {(uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24)};
+	fwrite(b, 1, 4, f);
+}
+
+static void put64(FILE *f, uint64_t v)
+{
+	put32(f, (uint32_t)v);
+	put32(f, (uint32_t)(v >> 32));
+}
+
+// readers latch a failure in ok, so a run of fields can be checked once
+static uint32_t get32(FILE *f, bool &ok)
+{
+	uint8_t b[4];
+	if (fread(b, 1, 4, f) != 4)
+	{
+		ok = false;
+		return 0;
+	}
+	return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static uint64_t get64(FILE *f, bool &ok)
+{
+	uint64_t lo = get32(f, ok);
+	return lo | ((uint64_t)get32(f, ok) << 32);
+}
+
+// an operation field, which later indexes the ISA tables: anything out of
+// range latches invalid rather than being used
+static Operation getOperation(FILE *f, bool &ok, bool &invalid)
+{
+	uint32_t op = get32(f, ok);
+	if (op >= NUM_OPERATIONS)
+	{
+		invalid = true;
+		return (Operation)0;
+	}
+	return (Operation)op;
+}
+
+// a register number, which later indexes registers[]: anything past
+// ZERO_SINK latches invalid
+static uint32_t getRegister(FILE *f, bool &ok, bool &invalid)
+{
+	uint32_t reg = get32(f, ok);
+	if (reg > (uint32_t)ZERO_SINK)
+	{
+		invalid = true;
+		return ZERO_SINK;
+	}
+	return reg;
+}
+
+static bool zeroPage(const uint8_t *p)
+{
+	for (uint32_t i = 0; i < GuestMemory::PAGE_SIZE; i++)
+	{
+		if (p[i] != 0)
+			return false;
+	}
+	return true;
+}
+
+bool CPU::saveCheckpoint(const char *path, string &error)
+{
+	FILE *f = fopen(path, "wb");
+	if (f == NULL)
+	{
+		error = "error opening checkpoint file";
+		return false;
+	}
+
+	fwrite(CHECKPOINT_MAGIC, 1, sizeof(CHECKPOINT_MAGIC), f);
+	put32(f, CHECKPOINT_VERSION);
+	put32(f, codeBase);
+	put32(f, endPC);
+
+	put32(f, PC);
+	for (int i = 0; i < 32; i++)
+	{
+		put32(f, registers[i]);
+	}
+
+	put32(f, operation);
+	put32(f, decodeInstr.rs1);
+	put32(f, decodeInstr.rs2);
+	put32(f, decodeInstr.rd);
+	put32(f, decodeInstr.immediate);
+	put32(f, executeInstr.aluResult);
+	put32(f, executeInstr.rs2);
+	put32(f, executeInstr.rd);
+	put32(f, memInstr.rd);
+	put32(f, memInstr.aluResult);
+	put32(f, memInstr.dataMem);
+
+	// predictor handles are not saved: a restored branch in flight is
+	// resolved without updating the predictor
+	put32(f, ifid.valid);
+	put32(f, ifid.pc);
+	put32(f, ifid.instr);
+	put32(f, ifid.predictedTaken);
+	put32(f, ifid.bubbleCounted);
+
+	put32(f, idex.valid);
+	put32(f, idex.pc);
+	put32(f, idex.predictedTaken);
+	put32(f, idex.op);
+	put32(f, idex.rs1Reg);
+	put32(f, idex.rs2Reg);
+	put32(f, idex.v.rs1);
+	put32(f, idex.v.rs2);
+	put32(f, idex.v.rd);
+	put32(f, idex.v.immediate);
+
+	put32(f, exmem.valid);
+	put32(f, exmem.op);
+	put32(f, exmem.v.aluResult);
+	put32(f, exmem.v.rs2);
+	put32(f, exmem.v.rd);
+
+	put32(f, memwb.valid);
+	put32(f, memwb.op);
+	put32(f, memwb.v.rd);
+	put32(f, memwb.v.aluResult);
+	put32(f, memwb.v.dataMem);
+	put32(f, memStallRemaining);
+	put32(f, fetchStallRemaining);
+	put32(f, fetchCharged);
+
+	put64(f, pipeStats.cycles);
+	put64(f, pipeStats.instructions);
+	put64(f, pipeStats.loadUseStalls);
+	put64(f, pipeStats.flushCycles);
+	put64(f, pipeStats.branches);
+	put64(f, pipeStats.mispredicts);
+	put64(f, pipeStats.predictorStalls);
+	put64(f, pipeStats.memoryStalls);
+	put64(f, pipeStats.fetchStalls);
+
+	put64(f, retiredCount);
+	put32(f, reservationValid);
+	put32(f, reservedAddress);
+	put32(f, reservedValue);
+
+	// pages that were only read are still all zeros and need not be stored
+	vector<uint32_t> pages = dmemory.allocatedPages();
+	vector<uint32_t> stored;
+	for (size_t i = 0; i < pages.size(); i++)
+	{
+		if (!zeroPage(dmemory.page(pages[i])))
+		{
+			stored.push_back(pages[i]);
+		}
+	}
+	put32(f, stored.size());
+	for (size_t i = 0; i < stored.size(); i++)
+	{
+		put32(f, stored[i]);
+		fwrite(dmemory.page(stored[i]), 1, GuestMemory::PAGE_SIZE, f);
+	}
+
+	bool ok = !ferror(f);
+	if (fclose(f) != 0 || !ok)
+	{
+		error = "error writing checkpoint file";
+		return false;
+	}
+	return true;
+}
+
+// restore state saved by saveCheckpoint. the program must already be loaded
+// (setBounds called) and must be the one the checkpoint was taken from.
+// everything is read and checked before any of it replaces the CPU's state,
+// so a bad file leaves the CPU as it was
+bool CPU::restoreCheckpoint(const char *path, string &error)
+{
+	FILE *f = fopen(path, "rb");
+	char magic[4];
+	if (f == NULL || fread(magic, 1, sizeof(magic), f) != sizeof(magic) || memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0)
+	{
+		if (f != NULL)
+			fclose(f);
+		error = "not a checkpoint file";
+		return false;
+	}
+
+	bool ok = true;
+	bool invalid = false;
+	if (get32(f, ok) != CHECKPOINT_VERSION)
+	{
+		fclose(f);
+		error = "unsupported checkpoint version";
+		return false;
+	}
+	uint32_t base = get32(f, ok);
+	uint32_t maxPC = get32(f, ok);
+	if (ok && (base != codeBase || maxPC != endPC))
+	{
+		fclose(f);
+		error = "checkpoint was taken from a different program";
+		return false;
+	}
+
+	unsigned long pc = get32(f, ok);
+	int32_t regs[32];
+	for (int i = 0; i < 32; i++)
+	{
+		regs[i] = get32(f, ok);
+	}
+
+	Operation op = getOperation(f, ok, invalid);
+	Decode d;
+	d.rs1 = get32(f, ok);
+	d.rs2 = get32(f, ok);
+	d.rd = getRegister(f, ok, invalid);
+	d.immediate = get32(f, ok);
+	Execute e;
+	e.aluResult = get32(f, ok);
+	e.rs2 = get32(f, ok);
+	e.rd = getRegister(f, ok, invalid);
+	Memory m;
+	m.rd = getRegister(f, ok, invalid);
+	m.aluResult = get32(f, ok);
+	m.dataMem = get32(f, ok);
+
+	FetchLatch fl;
+	fl.valid = get32(f, ok) != 0;
+	fl.pc = get32(f, ok);
+	fl.instr = get32(f, ok);
+	fl.predictedTaken = get32(f, ok) != 0;
+	fl.bubbleCounted = get32(f, ok) != 0;
+	fl.prediction = NULL;
+
+	DecodeLatch dl;
+	dl.valid = get32(f, ok) != 0;
+	dl.pc = get32(f, ok);
+	dl.predictedTaken = get32(f, ok) != 0;
+	dl.prediction = NULL;
+	dl.op = getOperation(f, ok, invalid);
+	dl.rs1Reg = getRegister(f, ok, invalid);
+	dl.rs2Reg = getRegister(f, ok, invalid);
+	dl.v.rs1 = get32(f, ok);
+	dl.v.rs2 = get32(f, ok);
+	dl.v.rd = getRegister(f, ok, invalid);
+	dl.v.immediate = get32(f, ok);
+
+	ExecuteLatch el;
+	el.valid = get32(f, ok) != 0;
+	el.op = getOperation(f, ok, invalid);
+	el.v.aluResult = get32(f, ok);
+	el.v.rs2 = get32(f, ok);
+	el.v.rd = getRegister(f, ok, invalid);
+
+	MemoryLatch ml;
+	ml.valid = get32(f, ok) != 0;
+	ml.op = getOperation(f, ok, invalid);
+	ml.v.rd = getRegister(f, ok, invalid);
+	ml.v.aluResult = get32(f, ok);
+	ml.v.dataMem = get32(f, ok);
+	uint32_t memStall = get32(f, ok);
+	uint32_t fetchStall = get32(f, ok);
+	bool charged = get32(f, ok) != 0;
+
+	PipelineStats stats;
+	stats.cycles = get64(f, ok);
+	stats.instructions = get64(f, ok);
+	stats.loadUseStalls = get64(f, ok);
+	stats.flushCycles = get64(f, ok);
+	stats.branches = get64(f, ok);
+	stats.mispredicts = get64(f, ok);
+	stats.predictorStalls = get64(f, ok);
+	stats.memoryStalls = get64(f, ok);
+	stats.fetchStalls = get64(f, ok);
+
+	unsigned long retired = get64(f, ok);
+	bool reserved = get32(f, ok) != 0;
+	int32_t reservedAt = get32(f, ok);
+	int32_t reservedWord = get32(f, ok);
+
+	// the pages are held until the whole file has been read
+	uint32_t count = get32(f, ok);
+	vector<uint32_t> pageAddresses;
+	vector<uint8_t> pageData;
+	for (uint32_t i = 0; i < count && ok; i++)
+	{
+		pageAddresses.push_back(get32(f, ok));
+		pageData.resize(pageData.size() + GuestMemory::PAGE_SIZE);
+		if (fread(&pageData[pageData.size() - GuestMemory::PAGE_SIZE], 1, GuestMemory::PAGE_SIZE, f) != GuestMemory::PAGE_SIZE)
+		{
+			ok = false;
+		}
+	}
+	fclose(f);
+
+	if (!ok)
+	{
+		error = "truncated checkpoint file";
+		return false;
+	}
+	if (invalid)
+	{
+		error = "checkpoint holds an unknown operation or register";
+		return false;
+	}
+
+	PC = pc;
+	memcpy(registers, regs, sizeof(regs));
+	operation = op;
+	decodeInstr = d;
+	executeInstr = e;
+	memInstr = m;
+	ifid = fl;
+	idex = dl;
+	exmem = el;
+	memwb = ml;
+	memStallRemaining = memStall;
+	fetchStallRemaining = fetchStall;
+	fetchCharged = charged;
+	pipeStats = stats;
+	predictionPending = false;
+	retiredCount = retired;
+	reservationValid = reserved;
+	reservedAddress = reservedAt;
+	reservedValue = reservedWord;
+
+	dmemory.clear();
+	for (size_t i = 0; i < pageAddresses.size(); i++)
+	{
+		dmemory.writeBlock(pageAddresses[i], &pageData[i * GuestMemory::PAGE_SIZE], GuestMemory::PAGE_SIZE);
+	}
+	return true;
+}
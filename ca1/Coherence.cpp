@@ -0,0 +1,33 @@
+#include "Coherence.h"
+
+CoherenceModel::CoherenceModel(uint32_t lineBytes)
+{
+	lineShift = 0;
+	while ((1u << lineShift) < lineBytes)
+	{
+		lineShift++;
+	}
+	requests = 0;
+}
+
+void CoherenceModel::access(unsigned hart, uint32_t addr, bool isWrite)
+{
+	// processCommand takes the request the way coherentsim reads it from a trace
+	static const string read = "read";
+	static const string write = "write";
+
+	lock_guard<mutex> hold(lock);
+	requests++;
+	protocol.processCommand(isWrite ? write : read, hart, (int)(addr >> lineShift));
+}
+
+void CoherenceModel::printStats(ostream &out)
+{
+	lock_guard<mutex> hold(lock);
+	out << "coherence requests: " << requests << endl;
+	out << "coherence hits: " << protocol.hits() << endl;
+	out << "coherence misses: " << protocol.misses() << endl;
+	out << "coherence writebacks: " << protocol.writebackCount() << endl;
+	out << "coherence broadcasts: " << protocol.broadcastCount() << endl;
+	out << "cache-to-cache transfers: " << protocol.transfers() << endl;
+}
@@ -0,0 +1,32 @@
+#ifndef COHERENCE_H
+#define COHERENCE_H
+
+#include "../ca3/moesif.h"
+
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+using namespace std;
+
+// runs every hart's data accesses through ca3's MOESIF protocol, one
+// coherence line per lineBytes of address. the protocol state is shared, so
+// requests from harts on different host threads are taken one at a time in
+// whatever order they arrive, and the counts can vary a little between runs
+class CoherenceModel
+{
+public:
+	static const unsigned MAX_HARTS = 4; // the protocol models 4 cores
+
+	CoherenceModel(uint32_t lineBytes);
+
+	void access(unsigned hart, uint32_t addr, bool isWrite);
+	void printStats(ostream &out);
+
+private:
+	MOESIFSimulator protocol;
+	uint32_t lineShift;
+	mutex lock;
+	uint64_t requests;
+};
+
+#endif
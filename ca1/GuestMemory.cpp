@@ -0,0 +1,144 @@
+#include "GuestMemory.h"
+#include <cstdlib>
+
+GuestMemory::GuestMemory()
+{
+	for (uint32_t i = 0; i < LEVEL_SIZE; i++)
+	{
+		directory[i].store(NULL, memory_order_relaxed);
+	}
+	tlbTag = 0xFFFFFFFF; // no page number is this large, so the TLB starts empty
+	tlbPage = NULL;
+	pageCount = 0;
+	backing = NULL;
+}
+
+GuestMemory::~GuestMemory()
+{
+	clear();
+}
+
+// find the page holding addr, allocating the table and page if needed
+uint8_t *GuestMemory::walk(uint32_t addr)
+{
+	if (backing != NULL)
+	{
+		return backing->walk(addr);
+	}
+
+	uint32_t top = addr >> (PAGE_BITS + LEVEL_BITS);
+	uint32_t mid = (addr >> PAGE_BITS) & (LEVEL_SIZE - 1);
+
+	PageEntry *table = directory[top].load(memory_order_acquire);
+	uint8_t *page = table != NULL ? table[mid].load(memory_order_acquire) : NULL;
+	return page != NULL ? page : allocate(addr);
+}
+
+// the slow path of walk: pages are published only once zeroed, so a walk that
+// finds one never sees it half made
+uint8_t *GuestMemory::allocate(uint32_t addr)
+{
+	uint32_t top = addr >> (PAGE_BITS + LEVEL_BITS);
+	uint32_t mid = (addr >> PAGE_BITS) & (LEVEL_SIZE - 1);
+	lock_guard<mutex> hold(allocation);
+
+	PageEntry *table = directory[top].load(memory_order_relaxed);
+	if (table == NULL)
+	{
+		table = new PageEntry[LEVEL_SIZE];
+		for (uint32_t i = 0; i < LEVEL_SIZE; i++)
+		{
+			table[i].store(NULL, memory_order_relaxed);
+		}
+		directory[top].store(table, memory_order_release);
+	}
+	uint8_t *page = table[mid].load(memory_order_relaxed);
+	if (page == NULL)
+	{
+		page = (uint8_t *)calloc(PAGE_SIZE, 1);
+		table[mid].store(page, memory_order_release);
+		pageCount++;
+	}
+	return page;
+}
+
+// share another memory's pages (this memory's own are released); the TLB
+// stays private, which is what lets each hart keep its own
+void GuestMemory::attach(GuestMemory *shared)
+{
+	clear();
+	backing = shared;
+}
+
+void GuestMemory::writeBlock(uint32_t addr, const uint8_t *src, size_t len)
+{
+	while (len > 0)
+	{
+		size_t chunk = PAGE_SIZE - (addr & (PAGE_SIZE - 1));
+		if (chunk > len)
+		{
+			chunk = len;
+		}
+		memcpy(page(addr), src, chunk);
+		addr += chunk;
+		src += chunk;
+		len -= chunk;
+	}
+}
+
+// release every page (an attached memory just forgets its TLB; the pages
+// belong to the memory it shares)
+void GuestMemory::clear()
+{
+	for (uint32_t i = 0; i < LEVEL_SIZE; i++)
+	{
+		PageEntry *table = directory[i].load(memory_order_relaxed);
+		if (table == NULL)
+			continue;
+
+		for (uint32_t j = 0; j < LEVEL_SIZE; j++)
+		{
+			free(table[j].load(memory_order_relaxed));
+		}
+		delete[] table;
+		directory[i].store(NULL, memory_order_relaxed);
+	}
+	tlbTag = 0xFFFFFFFF;
+	tlbPage = NULL;
+	pageCount = 0;
+}
+
+size_t GuestMemory::pagesAllocated()
+{
+	if (backing != NULL)
+	{
+		return backing->pagesAllocated();
+	}
+	lock_guard<mutex> hold(allocation);
+	return pageCount;
+}
+
+vector<uint32_t> GuestMemory::allocatedPages()
+{
+	if (backing != NULL)
+	{
+		return backing->allocatedPages();
+	}
+
+	vector<uint32_t> pages;
+	for (uint32_t i = 0; i < LEVEL_SIZE; i++)
+	{
+		PageEntry *table = directory[i].load(memory_order_acquire);
+		if (table == NULL)
+			continue;
+
+		for (uint32_t j = 0; j < LEVEL_SIZE; j++)
+		{
+			if (table[j].load(memory_order_acquire) != NULL)
+			{
+				pages.push_back(((i << LEVEL_BITS) | j) << PAGE_BITS);
+			}
+		}
+	}
+	return pages;
+}
@@ -0,0 +1,131 @@
+#ifndef GUESTMEMORY_H
+#define GUESTMEMORY_H
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include <atomic>
+#include <mutex>
+#include <vector>
+using namespace std;
+
+// sparse byte-addressable memory covering the full 32-bit address space.
+// 4KB pages are allocated (zeroed) the first time they are touched and found
+// through a two-level radix table; a one-entry TLB remembers the last page so
+// back-to-back accesses to the same page skip the table walk.
+// several harts share one memory by each attaching a GuestMemory of their own
+// (for the private TLB) to it; the shared table is read without locking and
+// only page allocation takes a lock, so harts on different host threads can
+// touch it at once
+class GuestMemory
+{
+public:
+	static const uint32_t PAGE_BITS = 12;
+	static const uint32_t PAGE_SIZE = 1 << PAGE_BITS;
+	static const uint32_t LEVEL_BITS = 10; // 10 + 10 + 12 = 32 address bits
+	static const uint32_t LEVEL_SIZE = 1 << LEVEL_BITS;
+
+	GuestMemory();
+	~GuestMemory();
+
+	uint8_t read8(uint32_t addr);
+	uint16_t read16(uint32_t addr);
+	uint32_t read32(uint32_t addr);
+	void write8(uint32_t addr, uint8_t value);
+	void write16(uint32_t addr, uint16_t value);
+	void write32(uint32_t addr, uint32_t value);
+
+	void writeBlock(uint32_t addr, const uint8_t *src, size_t len); // bulk copy, one memcpy per page
+
+	uint8_t *page(uint32_t addr); // host pointer to addr, allocating its page on first touch
+	void attach(GuestMemory *shared); // from now on use shared's pages (NULL goes back to private pages)
+	void clear();				  // release every page
+	size_t pagesAllocated();
+	vector<uint32_t> allocatedPages(); // base address of every allocated page, in address order
+
+private:
+	typedef atomic<uint8_t *> PageEntry;
+
+	atomic<PageEntry *> directory[LEVEL_SIZE]; // top level, indexed by addr[31:22]
+	uint32_t tlbTag;						   // page number (addr >> PAGE_BITS) held in the TLB
+	uint8_t *tlbPage;						   // host address of that page
+	size_t pageCount;
+	GuestMemory *backing; // memory whose pages this one uses, or NULL for its own
+	mutex allocation;	  // held while adding a table or page
+
+	uint8_t *walk(uint32_t addr);
+	uint8_t *allocate(uint32_t addr);
+
+	GuestMemory(const GuestMemory &);
+	GuestMemory &operator=(const GuestMemory &);
+};
+
+inline uint8_t *GuestMemory::page(uint32_t addr)
+{
+	if ((addr >> PAGE_BITS) != tlbTag)
+	{
+		tlbPage = walk(addr);
+		tlbTag = addr >> PAGE_BITS;
+	}
+	return tlbPage + (addr & (PAGE_SIZE - 1));
+}
+
+inline uint8_t GuestMemory::read8(uint32_t addr)
+{
+	return *page(addr);
+}
+
+inline void GuestMemory::write8(uint32_t addr, uint8_t value)
+{
+	*page(addr) = value;
+}
+
+// aligned halfwords and words never straddle a page, so they take a single 32-bit access
+// (the host is little endian like RISC-V); others go byte by byte
+inline uint16_t GuestMemory::read16(uint32_t addr)
+{
+	if ((addr & 1) == 0)
+	{
+		uint16_t half;
+		memcpy(&half, page(addr), 2);
+		return half;
+	}
+	return read8(addr) | (read8(addr + 1) << 8);
+}
+
+inline uint32_t GuestMemory::read32(uint32_t addr)
+{
+	if ((addr & 3) == 0)
+	{
+		uint32_t word;
+		memcpy(&word, page(addr), 4);
+		return word;
+	}
+	return read8(addr) | (read8(addr + 1) << 8) | (read8(addr + 2) << 16) | ((uint32_t)read8(addr + 3) << 24);
+}
+
+inline void GuestMemory::write16(uint32_t addr, uint16_t value)
+{
+	if ((addr & 1) == 0)
+	{
+		memcpy(page(addr), &value, 2);
+		return;
+	}
+	write8(addr, value & 0xFF);
+	write8(addr + 1, (value >> 8) & 0xFF);
+}
+
+inline void GuestMemory::write32(uint32_t addr, uint32_t value)
+{
+	if ((addr & 3) == 0)
+	{
+		memcpy(page(addr), &value, 4);
+		return;
+	}
+	write8(addr, value & 0xFF);
+	write8(addr + 1, (value >> 8) & 0xFF);
+	write8(addr + 2, (value >> 16) & 0xFF);
+	write8(addr + 3, (value >> 24) & 0xFF);
+}
+
+#endif
@@ -0,0 +1,255 @@
+#ifndef ISA_H
+#define ISA_H
+
+#include <cstdint>
+using namespace std;
+
+// the RV32I base ISA plus the M and A extensions, described once. each entry is
+//   X(name, format, mask, match, flags)
+// where an instruction word w is this instruction when (w & mask) == match
+// (the MASK_/MATCH_ values from the RISC-V opcode tables). the Operation enum,
+// the operation names, the per-operation flags and the decoder's lookup table
+// are all generated from this list
+#define RV32IMA_INSTRUCTIONS(X)                                       \
+	X(LUI, FORMAT_U, 0x0000007f, 0x00000037, OP_RD)                   \
+	X(AUIPC, FORMAT_U, 0x0000007f, 0x00000017, OP_RD)                 \
+	X(JAL, FORMAT_J, 0x0000007f, 0x0000006f, OP_RD | OP_JUMP)         \
+	X(JALR, FORMAT_I, 0x0000707f, 0x00000067, OP_RD | OP_RS1 | OP_JUMP) \
+	X(BEQ, FORMAT_B, 0x0000707f, 0x00000063, OP_RS1 | OP_RS2 | OP_BRANCH) \
+	X(BNE, FORMAT_B, 0x0000707f, 0x00001063, OP_RS1 | OP_RS2 | OP_BRANCH) \
+	X(BLT, FORMAT_B, 0x0000707f, 0x00004063, OP_RS1 | OP_RS2 | OP_BRANCH) \
+	X(BGE, FORMAT_B, 0x0000707f, 0x00005063, OP_RS1 | OP_RS2 | OP_BRANCH) \
+	X(BLTU, FORMAT_B, 0x0000707f, 0x00006063, OP_RS1 | OP_RS2 | OP_BRANCH) \
+	X(BGEU, FORMAT_B, 0x0000707f, 0x00007063, OP_RS1 | OP_RS2 | OP_BRANCH) \
+	X(LB, FORMAT_I, 0x0000707f, 0x00000003, OP_RD | OP_RS1 | OP_LOAD)   \
+	X(LH, FORMAT_I, 0x0000707f, 0x00001003, OP_RD | OP_RS1 | OP_LOAD)   \
+	X(LW, FORMAT_I, 0x0000707f, 0x00002003, OP_RD | OP_RS1 | OP_LOAD)   \
+	X(LBU, FORMAT_I, 0x0000707f, 0x00004003, OP_RD | OP_RS1 | OP_LOAD)  \
+	X(LHU, FORMAT_I, 0x0000707f, 0x00005003, OP_RD | OP_RS1 | OP_LOAD)  \
+	X(SB, FORMAT_S, 0x0000707f, 0x00000023, OP_RS1 | OP_RS2 | OP_STORE) \
+	X(SH, FORMAT_S, 0x0000707f, 0x00001023, OP_RS1 | OP_RS2 | OP_STORE) \
+	X(SW, FORMAT_S, 0x0000707f, 0x00002023, OP_RS1 | OP_RS2 | OP_STORE) \
+	X(ADDI, FORMAT_I, 0x0000707f, 0x00000013, OP_RD | OP_RS1)          \
+	X(SLTI, FORMAT_I, 0x0000707f, 0x00002013, OP_RD | OP_RS1)          \
+	X(SLTIU, FORMAT_I, 0x0000707f, 0x00003013, OP_RD | OP_RS1)         \
+	X(XORI, FORMAT_I, 0x0000707f, 0x00004013, OP_RD | OP_RS1)          \
+	X(ORI, FORMAT_I, 0x0000707f, 0x00006013, OP_RD | OP_RS1)           \
+	X(ANDI, FORMAT_I, 0x0000707f, 0x00007013, OP_RD | OP_RS1)          \
+	X(SLLI, FORMAT_I, 0xfe00707f, 0x00001013, OP_RD | OP_RS1)          \
+	X(SRLI, FORMAT_I, 0xfe00707f, 0x00005013, OP_RD | OP_RS1)          \
+	X(SRAI, FORMAT_I, 0xfe00707f, 0x40005013, OP_RD | OP_RS1)          \
+	X(ADD, FORMAT_R, 0xfe00707f, 0x00000033, OP_RD | OP_RS1 | OP_RS2)  \
+	X(SUB, FORMAT_R, 0xfe00707f, 0x40000033, OP_RD | OP_RS1 | OP_RS2)  \
+	X(SLL, FORMAT_R, 0xfe00707f, 0x00001033, OP_RD | OP_RS1 | OP_RS2)  \
+	X(SLT, FORMAT_R, 0xfe00707f, 0x00002033, OP_RD | OP_RS1 | OP_RS2)  \
+	X(SLTU, FORMAT_R, 0xfe00707f, 0x00003033, OP_RD | OP_RS1 | OP_RS2) \
+	X(XOR, FORMAT_R, 0xfe00707f, 0x00004033, OP_RD | OP_RS1 | OP_RS2)  \
+	X(SRL, FORMAT_R, 0xfe00707f, 0x00005033, OP_RD | OP_RS1 | OP_RS2)  \
+	X(SRA, FORMAT_R, 0xfe00707f, 0x40005033, OP_RD | OP_RS1 | OP_RS2)  \
+	X(OR, FORMAT_R, 0xfe00707f, 0x00006033, OP_RD | OP_RS1 | OP_RS2)   \
+	X(AND, FORMAT_R, 0xfe00707f, 0x00007033, OP_RD | OP_RS1 | OP_RS2)  \
+	X(FENCE, FORMAT_I, 0x0000707f, 0x0000000f, 0)                      \
+	X(ECALL, FORMAT_I, 0xffffffff, 0x00000073, 0)                      \
+	X(EBREAK, FORMAT_I, 0xffffffff, 0x00100073, 0)                     \
+	X(MUL, FORMAT_R, 0xfe00707f, 0x02000033, OP_RD | OP_RS1 | OP_RS2)  \
+	X(MULH, FORMAT_R, 0xfe00707f, 0x02001033, OP_RD | OP_RS1 | OP_RS2) \
+	X(MULHSU, FORMAT_R, 0xfe00707f, 0x02002033, OP_RD | OP_RS1 | OP_RS2) \
+	X(MULHU, FORMAT_R, 0xfe00707f, 0x02003033, OP_RD | OP_RS1 | OP_RS2) \
+	X(DIV, FORMAT_R, 0xfe00707f, 0x02004033, OP_RD | OP_RS1 | OP_RS2)  \
+	X(DIVU, FORMAT_R, 0xfe00707f, 0x02005033, OP_RD | OP_RS1 | OP_RS2) \
+	X(REM, FORMAT_R, 0xfe00707f, 0x02006033, OP_RD | OP_RS1 | OP_RS2)  \
+	X(REMU, FORMAT_R, 0xfe00707f, 0x02007033, OP_RD | OP_RS1 | OP_RS2) \
+	X(LR_W, FORMAT_R, 0xf9f0707f, 0x1000202f, OP_RD | OP_RS1 | OP_LOAD | OP_ATOMIC) \
+	X(SC_W, FORMAT_R, 0xf800707f, 0x1800202f, OP_RD | OP_RS1 | OP_RS2 | OP_LOAD | OP_STORE | OP_ATOMIC) \
+	X(AMOSWAP_W, FORMAT_R, 0xf800707f, 0x0800202f, OP_RD | OP_RS1 | OP_RS2 | OP_LOAD | OP_STORE | OP_ATOMIC) \
+	X(AMOADD_W, FORMAT_R, 0xf800707f, 0x0000202f, OP_RD | OP_RS1 | OP_RS2 | OP_LOAD | OP_STORE | OP_ATOMIC) \
+	X(AMOXOR_W, FORMAT_R, 0xf800707f, 0x2000202f, OP_RD | OP_RS1 | OP_RS2 | OP_LOAD | OP_STORE | OP_ATOMIC) \
+	X(AMOAND_W, FORMAT_R, 0xf800707f, 0x6000202f, OP_RD | OP_RS1 | OP_RS2 | OP_LOAD | OP_STORE | OP_ATOMIC) \
+	X(AMOOR_W, FORMAT_R, 0xf800707f, 0x4000202f, OP_RD | OP_RS1 | OP_RS2 | OP_LOAD | OP_STORE | OP_ATOMIC) \
+	X(AMOMIN_W, FORMAT_R, 0xf800707f, 0x8000202f, OP_RD | OP_RS1 | OP_RS2 | OP_LOAD | OP_STORE | OP_ATOMIC) \
+	X(AMOMAX_W, FORMAT_R, 0xf800707f, 0xa000202f, OP_RD | OP_RS1 | OP_RS2 | OP_LOAD | OP_STORE | OP_ATOMIC) \
+	X(AMOMINU_W, FORMAT_R, 0xf800707f, 0xc000202f, OP_RD | OP_RS1 | OP_RS2 | OP_LOAD | OP_STORE | OP_ATOMIC) \
+	X(AMOMAXU_W, FORMAT_R, 0xf800707f, 0xe000202f, OP_RD | OP_RS1 | OP_RS2 | OP_LOAD | OP_STORE | OP_ATOMIC)
+
+enum Format
+{
+	FORMAT_R,
+	FORMAT_I,
+	FORMAT_S,
+	FORMAT_B,
+	FORMAT_U,
+	FORMAT_J
+};
+
+// what an operation does, for hazard detection, tracing and the timing models
+enum OperationFlags
+{
+	OP_RD = 1,		// writes rd
+	OP_RS1 = 2,		// reads rs1
+	OP_RS2 = 4,		// reads rs2
+	OP_LOAD = 8,
+	OP_STORE = 16,
+	OP_BRANCH = 32, // conditional branch
+	OP_JUMP = 64,	// JAL/JALR
+	OP_ATOMIC = 128 // LR/SC/AMO; their rd comes out of the memory stage like a load's
+};
+
+// NOP doubles as the operation for any word that is not a valid instruction
+enum Operation
+{
+#define RV_ENUM(name, format, mask, match, flags) name,
+	RV32IMA_INSTRUCTIONS(RV_ENUM)
+#undef RV_ENUM
+	NOP,
+	NUM_OPERATIONS
+};
+
+const char *operationName(Operation op);
+
+inline unsigned operationFlags(Operation op)
+{
+	static const unsigned char flags[NUM_OPERATIONS] = {
+#define RV_FLAGS(name, format, mask, match, flags) flags,
+		RV32IMA_INSTRUCTIONS(RV_FLAGS)
+#undef RV_FLAGS
+		0};
+	return flags[op];
+}
+
+inline Format operationFormat(Operation op)
+{
+	static const unsigned char formats[NUM_OPERATIONS] = {
+#define RV_FORMAT(name, format, mask, match, flags) format,
+		RV32IMA_INSTRUCTIONS(RV_FORMAT)
+#undef RV_FORMAT
+		FORMAT_I};
+	return (Format)formats[op];
+}
+
+// integer semantics shared by every engine, with a = rs1 and b = rs2 or the
+// immediate. immediate forms use the register form's operation (ADDI is
+// alu(ADD, ...)), and called with a constant op the switch folds away
+inline int32_t alu(Operation op, int32_t a, int32_t b)
+{
+	switch (op)
+	{
+	case ADD:
+		return (int32_t)((uint32_t)a + (uint32_t)b);
+	case SUB:
+		return (int32_t)((uint32_t)a - (uint32_t)b);
+	case SLL:
+		return (int32_t)((uint32_t)a << (b & 0x1F));
+	case SLT:
+		return a < b;
+	case SLTU:
+		return (uint32_t)a < (uint32_t)b;
+	case XOR:
+		return a ^ b;
+	case SRL:
+		return (int32_t)((uint32_t)a >> (b & 0x1F));
+	case SRA:
+		return a >> (b & 0x1F);
+	case OR:
+		return a | b;
+	case AND:
+		return a & b;
+	case MUL:
+		return (int32_t)((uint32_t)a * (uint32_t)b);
+	case MULH:
+		return (int32_t)(((int64_t)a * (int64_t)b) >> 32);
+	case MULHSU:
+		return (int32_t)(((int64_t)a * (int64_t)(uint32_t)b) >> 32);
+	case MULHU:
+		return (int32_t)(((uint64_t)(uint32_t)a * (uint32_t)b) >> 32);
+	// division by zero and overflow give the results the spec defines instead of trapping
+	case DIV:
+		return b == 0 ? -1 : (a == INT32_MIN && b == -1) ? a : a / b;
+	case DIVU:
+		return b == 0 ? -1 : (int32_t)((uint32_t)a / (uint32_t)b);
+	case REM:
+		return b == 0 ? a : (a == INT32_MIN && b == -1) ? 0 : a % b;
+	case REMU:
+		return b == 0 ? a : (int32_t)((uint32_t)a % (uint32_t)b);
+	default:
+		return 0;
+	}
+}
+
+// the register-register operation an immediate ALU operation computes
+inline Operation immediateBase(Operation op)
+{
+	switch (op)
+	{
+	case ADDI:
+		return ADD;
+	case SLTI:
+		return SLT;
+	case SLTIU:
+		return SLTU;
+	case XORI:
+		return XOR;
+	case ORI:
+		return OR;
+	case ANDI:
+		return AND;
+	case SLLI:
+		return SLL;
+	case SRLI:
+		return SRL;
+	case SRAI:
+		return SRA;
+	default:
+		return op;
+	}
+}
+
+inline bool branchTaken(Operation op, int32_t a, int32_t b)
+{
+	switch (op)
+	{
+	case BEQ:
+		return a == b;
+	case BNE:
+		return a != b;
+	case BLT:
+		return a < b;
+	case BGE:
+		return a >= b;
+	case BLTU:
+		return (uint32_t)a < (uint32_t)b;
+	case BGEU:
+		return (uint32_t)a >= (uint32_t)b;
+	default:
+		return false;
+	}
+}
+
+// the value an AMO writes back, from the old memory word and rs2
+inline int32_t amo(Operation op, int32_t old, int32_t value)
+{
+	switch (op)
+	{
+	case AMOSWAP_W:
+		return value;
+	case AMOADD_W:
+		return (int32_t)((uint32_t)old + (uint32_t)value);
+	case AMOXOR_W:
+		return old ^ value;
+	case AMOAND_W:
+		return old & value;
+	case AMOOR_W:
+		return old | value;
+	case AMOMIN_W:
+		return old < value ? old : value;
+	case AMOMAX_W:
+		return old > value ? old : value;
+	case AMOMINU_W:
+		return (uint32_t)old < (uint32_t)value ? old : value;
+	case AMOMAXU_W:
+		return (uint32_t)old > (uint32_t)value ? old : value;
+	default:
+		return old;
+	}
+}
+
+#endif
@@ -0,0 +1,228 @@
+#include "Loader.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// the parts of the ELF32 format the loader needs (kept here rather than
+// relying on <elf.h>, which not every platform ships)
+struct Elf32Header
+{
+	uint8_t ident[16];
+	uint16_t type;
+	uint16_t machine;
+	uint32_t version;
+	uint32_t entry;
+	uint32_t phoff;
+	uint32_t shoff;
+	uint32_t flags;
+	uint16_t ehsize;
+	uint16_t phentsize;
+	uint16_t phnum;
+	uint16_t shentsize;
+	uint16_t shnum;
+	uint16_t shstrndx;
+};
+
+struct Elf32ProgramHeader
+{
+	uint32_t type;
+	uint32_t offset;
+	uint32_t vaddr;
+	uint32_t paddr;
+	uint32_t filesz;
+	uint32_t memsz;
+	uint32_t flags;
+	uint32_t align;
+};
+
+static const uint32_t PT_LOAD_SEGMENT = 1;
+static const uint32_t PF_EXECUTE = 1;
+static const uint16_t MACHINE_RISCV = 243;
+
+static bool isHexText(const uint8_t *data, size_t size)
+{
+	for (size_t i = 0; i < size; i++)
+	{
+		uint8_t c = data[i];
+		bool ok = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F') ||
+				  c == 'x' || c == 'X' || c == ' ' || c == '\t' || c == '\r' || c == '\n';
+		if (!ok)
+			return false;
+	}
+	return true;
+}
+
+static int hexDigit(uint8_t c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+// one hex byte per whitespace-separated token (an optional 0x prefix is
+// allowed), written straight into instruction memory as it is parsed
+static void loadHex(const uint8_t *data, size_t size, GuestMemory &instMem, Program &prog)
+{
+	uint32_t addr = 0;
+	size_t i = 0;
+
+	while (i < size)
+	{
+		// skip whitespace between tokens
+		while (i < size && hexDigit(data[i]) < 0 && data[i] != 'x' && data[i] != 'X')
+			i++;
+		if (i == size)
+			break;
+
+		if (data[i] == '0' && i + 1 < size && (data[i + 1] == 'x' || data[i + 1] == 'X'))
+			i += 2;
+
+		uint32_t value = 0;
+		while (i < size && hexDigit(data[i]) >= 0)
+		{
+			value = (value << 4) | hexDigit(data[i]);
+			i++;
+		}
+		// a stray 'x' in the middle of a token ends it
+		while (i < size && (data[i] == 'x' || data[i] == 'X'))
+			i++;
+
+		instMem.write8(addr, value & 0xFF);
+		addr++;
+	}
+
+	prog.entry = 0;
+	prog.base = 0;
+	prog.end = addr;
+}
+
+static bool loadElf(const uint8_t *data, size_t size, GuestMemory &instMem, GuestMemory &dataMem, Program &prog, string &error)
+{
+	Elf32Header header;
+	if (size < sizeof(header))
+	{
+		error = "truncated ELF header";
+		return false;
+	}
+	memcpy(&header, data, sizeof(header));
+
+	if (header.ident[4] != 1 || header.ident[5] != 1 || header.machine != MACHINE_RISCV)
+	{
+		error = "not a little-endian 32-bit RISC-V ELF file";
+		return false;
+	}
+	if (header.phentsize != sizeof(Elf32ProgramHeader) ||
+		(uint64_t)header.phoff + (uint64_t)header.phnum * sizeof(Elf32ProgramHeader) > size)
+	{
+		error = "bad ELF program header table";
+		return false;
+	}
+
+	bool haveText = false;
+	prog.entry = header.entry;
+	prog.base = 0;
+	prog.end = 0;
+
+	for (uint16_t i = 0; i < header.phnum; i++)
+	{
+		Elf32ProgramHeader ph;
+		memcpy(&ph, data + header.phoff + i * sizeof(ph), sizeof(ph));
+
+		if (ph.type != PT_LOAD_SEGMENT || ph.filesz == 0)
+			continue;
+		if ((uint64_t)ph.offset + ph.filesz > size)
+		{
+			error = "ELF segment runs past the end of the file";
+			return false;
+		}
+
+		if (ph.flags & PF_EXECUTE)
+		{
+			// text goes to instruction memory, and to data memory as well so
+			// loads can reach constants and literal pools kept beside the code
+			instMem.writeBlock(ph.vaddr, data + ph.offset, ph.filesz);
+			dataMem.writeBlock(ph.vaddr, data + ph.offset, ph.filesz);
+			if (!haveText || ph.vaddr < prog.base)
+				prog.base = ph.vaddr;
+			if (!haveText || ph.vaddr + ph.filesz > prog.end)
+				prog.end = ph.vaddr + ph.filesz;
+			haveText = true;
+		}
+		else
+		{
+			// initialised data; the rest of memsz (bss) is already zero
+			dataMem.writeBlock(ph.vaddr, data + ph.offset, ph.filesz);
+		}
+	}
+
+	if (!haveText)
+	{
+		error = "ELF file has no executable segment";
+		return false;
+	}
+	return true;
+}
+
+bool loadProgram(const char *path, GuestMemory &instMem, GuestMemory &dataMem, Program &prog, string &error)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		error = "error opening file";
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		close(fd);
+		error = "error opening file";
+		return false;
+	}
+
+	size_t size = st.st_size;
+	if (size == 0)
+	{
+		// nothing to map; an empty program
+		close(fd);
+		prog.entry = prog.base = prog.end = 0;
+		return true;
+	}
+
+	void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		error = "error mapping file";
+		return false;
+	}
+
+	const uint8_t *data = (const uint8_t *)map;
+	bool ok = true;
+
+	if (size >= 4 && data[0] == 0x7F && data[1] == 'E' && data[2] == 'L' && data[3] == 'F')
+	{
+		ok = loadElf(data, size, instMem, dataMem, prog, error);
+	}
+	else if (isHexText(data, size))
+	{
+		loadHex(data, size, instMem, prog);
+	}
+	else
+	{
+		// raw binary image at address 0
+		instMem.writeBlock(0, data, size);
+		prog.entry = 0;
+		prog.base = 0;
+		prog.end = size;
+	}
+
+	munmap(map, size);
+	return ok;
+}
@@ -0,0 +1,27 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include "GuestMemory.h"
+
+#include <string>
+using namespace std;
+
+// where a loaded program lives in instruction memory
+struct Program
+{
+	uint32_t entry; // first PC to execute
+	uint32_t base;	// lowest instruction address
+	uint32_t end;	// one past the last instruction byte
+};
+
+// load a program into instruction memory (and any initialised data into data
+// memory). the file is mapped with mmap and the format is picked from its
+// contents:
+//   - an ELF32 RISC-V image: executable PT_LOAD segments go to instMem,
+//     the others to dataMem, and execution starts at the ELF entry point
+//   - a text file of hex bytes, one per line (the course format)
+//   - anything else is a raw little-endian binary loaded at address 0
+// returns false and sets error if the file cannot be read or is malformed
+bool loadProgram(const char *path, GuestMemory &instMem, GuestMemory &dataMem, Program &prog, string &error);
+
+#endif
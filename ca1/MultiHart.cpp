@@ -0,0 +1,235 @@
+#include "MultiHart.h"
+
+#include <thread>
+#include <vector>
+
+QuantumBarrier::QuantumBarrier(unsigned harts)
+{
+	running = harts;
+	waiting = 0;
+	generation = 0;
+}
+
+void QuantumBarrier::arrive()
+{
+	unique_lock<mutex> hold(lock);
+	unsigned long quantum = generation;
+	if (++waiting == running)
+	{
+		waiting = 0;
+		generation++;
+		released.notify_all();
+		return;
+	}
+	released.wait(hold, [&] { return generation != quantum; });
+}
+
+void QuantumBarrier::leave()
+{
+	lock_guard<mutex> hold(lock);
+	running--;
+	if (running > 0 && waiting == running)
+	{
+		// everyone else was only waiting for this hart
+		waiting = 0;
+		generation++;
+		released.notify_all();
+	}
+}
+
+// run up to quantum instructions (cycles on the pipeline) of the program in
+// [base, maxPC], adding how many ran to executed; false once the hart has
+// left it or stopped
+static bool runQuantum(CPU &cpu, GuestMemory &instMem, const SimOptions &opt, unsigned long quantum, unsigned long base, unsigned long maxPC, unsigned long &executed)
+{
+	if (opt.pipelined)
+	{
+		for (unsigned long i = 0; i < quantum; i++)
+		{
+			// after ECALL or a halt store the pipeline drains before cycle() says so
+			if (!cpu.cycle(instMem) || cpu.stopReason() == STOP_WATCHDOG)
+				return false;
+			executed++;
+		}
+		return true;
+	}
+
+	if (opt.blocks)
+	{
+		executed += cpu.runBlocks(quantum);
+	}
+	else
+	{
+		Instruction instruction = Instruction(0);
+		for (unsigned long i = 0; i < quantum; i++)
+		{
+			if (cpu.readPC() > maxPC || cpu.readPC() < base || cpu.stopReason() != STOP_NONE)
+				break;
+
+			if (opt.predecoded)
+			{
+				cpu.fetchDecoded();
+			}
+			else
+			{
+				instruction = Instruction(cpu.fetch(instMem));
+				cpu.decode(&instruction);
+			}
+			cpu.execute();
+			cpu.memory();
+			cpu.writeback();
+			executed++;
+		}
+	}
+	return cpu.readPC() <= maxPC && cpu.readPC() >= base && cpu.stopReason() == STOP_NONE;
+}
+
+// whether hart's budget in opt has run out after executed quanta units (see
+// runQuantum); if so, records which one on the CPU
+static bool overBudget(CPU &cpu, const SimOptions &opt, unsigned long executed)
+{
+	StopReason reason;
+	unsigned long limit = instructionBudget(opt, reason);
+	if (opt.pipelined)
+	{
+		// executed counts cycles; instructions are only checked between quanta
+		if (opt.maxCycles != 0 && executed >= opt.maxCycles)
+			reason = STOP_CYCLE_LIMIT;
+		else if (opt.maxInstructions != 0 && cpu.pipelineStats().instructions >= opt.maxInstructions)
+			reason = STOP_INSTRUCTION_LIMIT;
+		else
+			return false;
+	}
+	else if (executed < limit)
+	{
+		return false;
+	}
+	cpu.setStopReason(reason);
+	return true;
+}
+
+bool runHarts(const char *path, const SimOptions &opt, const HartOptions &harts, string &error)
+{
+	if (harts.harts == 0 || (harts.coherence && harts.harts > CoherenceModel::MAX_HARTS))
+	{
+		error = "the coherence protocol models 1 to 4 harts";
+		return false;
+	}
+
+	// one copy of the program and its data, which every hart attaches to
+	GuestMemory instShared;
+	GuestMemory dataShared;
+	Program prog;
+	if (!loadProgram(path, instShared, dataShared, prog, error))
+	{
+		return false;
+	}
+	if (prog.end <= prog.base)
+	{
+		// empty program
+		return true;
+	}
+	unsigned long base = prog.base;
+	unsigned long maxPC = prog.end - 4;
+
+	CoherenceModel *coherence = harts.coherence ? new CoherenceModel(64) : NULL;
+	vector<CPU *> cpus(harts.harts);
+	vector<GuestMemory *> instViews(harts.harts);
+	vector<branch_predictor *> predictors(harts.harts, NULL);
+	bool ok = true;
+	for (unsigned h = 0; h < harts.harts; h++)
+	{
+		// instruction memory is only read, but its TLB is per hart too
+		instViews[h] = new GuestMemory();
+		instViews[h]->attach(&instShared);
+		cpus[h] = new CPU();
+		cpus[h]->dataMemory().attach(&dataShared);
+		cpus[h]->setPC(prog.entry);
+		cpus[h]->setBounds(base, maxPC);
+		cpus[h]->setReg(10, h); // a0
+		cpus[h]->setReg(4, h);	// tp
+		cpus[h]->setCoherence(coherence, h);
+		if (opt.haltAtAddress)
+		{
+			cpus[h]->setHaltAddress(opt.haltAddress);
+		}
+		if (opt.predecoded)
+		{
+			cpus[h]->predecode(*instViews[h]);
+		}
+		if (opt.pipelined && ok)
+		{
+			ok = makePredictor(opt.predictorName, predictors[h], error);
+			cpus[h]->setBranchPredictor(predictors[h]);
+		}
+	}
+
+	if (ok)
+	{
+		// unsynchronised harts run to the end in one go
+		unsigned long quantum = harts.quantum ? harts.quantum : (unsigned long)-1;
+		QuantumBarrier barrier(harts.harts);
+		vector<thread> threads;
+		for (unsigned h = 0; h < harts.harts; h++)
+		{
+			threads.push_back(thread([&, h] {
+				// a budget cuts the last quantum short
+				StopReason reason;
+				unsigned long limit = opt.pipelined ? (opt.maxCycles ? opt.maxCycles : (unsigned long)-1) : instructionBudget(opt, reason);
+				unsigned long executed = 0;
+				while (runQuantum(*cpus[h], *instViews[h], opt, min(quantum, limit - executed), base, maxPC, executed) &&
+					   !overBudget(*cpus[h], opt, executed))
+				{
+					if (harts.quantum)
+						barrier.arrive();
+				}
+				barrier.leave();
+			}));
+		}
+		{
+			// a watchdog per hart, all started with the run
+			vector<Watchdog *> watchdogs;
+			for (unsigned h = 0; h < harts.harts; h++)
+			{
+				watchdogs.push_back(new Watchdog(*cpus[h], opt.timeLimit));
+			}
+			for (size_t t = 0; t < threads.size(); t++)
+			{
+				threads[t].join();
+			}
+			for (unsigned h = 0; h < harts.harts; h++)
+			{
+				delete watchdogs[h];
+			}
+		}
+
+		for (unsigned h = 0; h < harts.harts; h++)
+		{
+			cpus[h]->printRegs();
+		}
+		for (unsigned h = 0; h < harts.harts; h++)
+		{
+			if (cpus[h]->stopReason() != STOP_NONE)
+				cerr << "hart " << h << " stopped: " << stopReasonName(cpus[h]->stopReason()) << endl;
+		}
+		for (unsigned h = 0; opt.pipelined && h < harts.harts; h++)
+		{
+			cerr << "hart " << h << ":" << endl;
+			cpus[h]->printPipelineStats();
+		}
+		if (coherence != NULL)
+		{
+			coherence->printStats(cerr);
+		}
+	}
+
+	for (unsigned h = 0; h < harts.harts; h++)
+	{
+		cpus[h]->setBranchPredictor(NULL);
+		delete predictors[h];
+		delete cpus[h];
+		delete instViews[h];
+	}
+	delete coherence;
+	return ok;
+}
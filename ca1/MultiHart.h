@@ -0,0 +1,47 @@
+#ifndef MULTIHART_H
+#define MULTIHART_H
+
+#include "Simulator.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+using namespace std;
+
+// the harts of a multi-hart run meet here at the end of every quantum, so none
+// gets more than a quantum ahead of the others. a hart whose program has
+// finished leaves instead, and the rest stop waiting for it
+class QuantumBarrier
+{
+public:
+	QuantumBarrier(unsigned harts);
+
+	void arrive(); // wait for every hart still running to finish the quantum
+	void leave();
+
+private:
+	mutex lock;
+	condition_variable released;
+	unsigned running;
+	unsigned waiting;
+	unsigned long generation; // quanta completed
+};
+
+struct HartOptions
+{
+	unsigned harts;
+	unsigned long quantum; // instructions (cycles with --pipeline) between barriers; 0 runs unsynchronised
+	bool coherence;		   // route data accesses through ca3's MOESIF protocol
+
+	HartOptions() : harts(1), quantum(10000), coherence(false) {}
+};
+
+// load the program once and run it on several harts at once, each a CPU on
+// its own host thread over one shared data memory. hart i starts at the entry
+// point with a0 and tp set to i (the only way it can tell itself apart), and
+// the harts' (a0,a1) are printed in order once every one has left the
+// program. interleaving within a quantum is up to the host, so programs that
+// race get results that can vary from run to run
+bool runHarts(const char *path, const SimOptions &opt, const HartOptions &harts, string &error);
+
+#endif
@@ -0,0 +1,276 @@
+#include "OutOfOrder.h"
+
+#include <cstdlib>
+#include <iomanip>
+#include <sstream>
+
+bool parseOooConfig(const string &spec, OooConfig &config, string &error)
+{
+	stringstream ss(spec);
+	string item;
+	while (getline(ss, item, ','))
+	{
+		if (item.empty() || item == "default")
+			continue;
+
+		size_t eq = item.find('=');
+		unsigned long n = eq == string::npos ? 0 : strtoul(item.c_str() + eq + 1, NULL, 0);
+		string key = item.substr(0, eq);
+
+		if (key == "width")
+			config.width = n;
+		else if (key == "rob")
+			config.robSize = n;
+		else if (key == "rs")
+			config.rsSize = n;
+		else if (key == "lsq")
+			config.lsqSize = n;
+		else if (key == "mispredict")
+			config.mispredictPenalty = n;
+		else if (key == "load")
+			config.loadLatency = n;
+		else if (key == "mul")
+			config.mulLatency = n;
+		else if (key == "div")
+			config.divLatency = n;
+		else
+		{
+			error = "bad out-of-order option " + item;
+			return false;
+		}
+	}
+
+	if (config.width == 0 || config.robSize == 0 || config.rsSize == 0 || config.lsqSize == 0)
+	{
+		error = "width, rob, rs and lsq must be non-zero";
+		return false;
+	}
+	return true;
+}
+
+OutOfOrderModel::OutOfOrderModel(const OooConfig &c) : config(c)
+{
+	predictor = NULL;
+	for (int i = 0; i < 32; i++)
+	{
+		regReady[i] = 0;
+	}
+	IssueSlot empty = {~0ull, 0};
+	issueSlots.assign(ISSUE_RING, empty);
+	StoreEntry none = {0, 0};
+	stores.assign(STORE_TABLE, none);
+
+	dispatchCycle = 0;
+	dispatchedThisCycle = 0;
+	commitCycle = 0;
+	committedThisCycle = 0;
+	fetchResume = 0;
+
+	instructions = 0;
+	branches = 0;
+	mispredicts = 0;
+	robStalls = 0;
+	rsStalls = 0;
+	lsqStalls = 0;
+}
+
+void OutOfOrderModel::setBranchPredictor(branch_predictor *bp)
+{
+	predictor = bp;
+}
+
+// execution latency on a hit, from issue to the result being ready
+uint32_t OutOfOrderModel::latency(Operation op)
+{
+	switch (op)
+	{
+	case MUL:
+	case MULH:
+	case MULHSU:
+	case MULHU:
+		return config.mulLatency;
+	case DIV:
+	case DIVU:
+	case REM:
+	case REMU:
+		return config.divLatency;
+	default:
+		return (operationFlags(op) & OP_LOAD) ? config.loadLatency : 1;
+	}
+}
+
+void OutOfOrderModel::instruction(const DecodedInstr &d, const TraceRecord &r, bool taken, uint32_t fetchCost, uint32_t memCost)
+{
+	unsigned flags = operationFlags(d.op);
+	bool isMemory = (flags & (OP_LOAD | OP_STORE)) != 0;
+	bool isLoad = (flags & OP_LOAD) != 0;
+
+	// dispatch: in order, width per cycle, once the front end has the
+	// instruction and there is room for it
+	uint64_t dispatch = dispatchCycle;
+	if (dispatchedThisCycle == config.width)
+	{
+		dispatch++;
+	}
+	if (fetchCost > 0 && fetchResume < dispatch + fetchCost)
+	{
+		fetchResume = dispatch + fetchCost;
+	}
+	if (fetchResume > dispatch)
+	{
+		dispatch = fetchResume;
+	}
+
+	if (rob.size() == config.robSize)
+	{
+		// the oldest instruction has to commit first
+		uint64_t free = rob.front() + 1;
+		if (free > dispatch)
+		{
+			robStalls += free - dispatch;
+			dispatch = free;
+		}
+		rob.pop_front();
+	}
+	if (isMemory && lsq.size() == config.lsqSize)
+	{
+		uint64_t free = lsq.front() + 1;
+		if (free > dispatch)
+		{
+			lsqStalls += free - dispatch;
+			dispatch = free;
+		}
+		lsq.pop_front();
+	}
+	while (!rs.empty() && rs.top() < dispatch)
+	{
+		rs.pop();
+	}
+	if (rs.size() == config.rsSize)
+	{
+		// wait for the first waiting instruction to issue and free its entry
+		uint64_t free = rs.top() + 1;
+		if (free > dispatch)
+		{
+			rsStalls += free - dispatch;
+			dispatch = free;
+		}
+		rs.pop();
+	}
+
+	if (dispatch != dispatchCycle)
+	{
+		dispatchCycle = dispatch;
+		dispatchedThisCycle = 0;
+	}
+	dispatchedThisCycle++;
+
+	// issue: operands come from the renamed producers (x0 is always ready)
+	uint64_t ready = dispatch + 1;
+	bool usesRs1 = (flags & OP_RS1) != 0;
+	bool usesRs2 = (flags & OP_RS2) != 0;
+	if (usesRs1 && d.rs1 != 0 && regReady[d.rs1] > ready)
+		ready = regReady[d.rs1];
+	if (usesRs2 && d.rs2 != 0 && regReady[d.rs2] > ready)
+		ready = regReady[d.rs2];
+
+	StoreEntry &forward = stores[(r.address >> 2) % STORE_TABLE];
+	if (isLoad && forward.address == (r.address >> 2) + 1 && forward.ready > ready)
+	{
+		// the value comes from an older store still in flight
+		ready = forward.ready;
+	}
+
+	uint64_t issue = ready;
+	while (true)
+	{
+		IssueSlot &slot = issueSlots[issue % ISSUE_RING];
+		if (slot.cycle != issue)
+		{
+			slot.cycle = issue;
+			slot.used = 0;
+		}
+		if (slot.used < config.width)
+		{
+			slot.used++;
+			break;
+		}
+		issue++;
+	}
+	rs.push(issue);
+
+	uint64_t complete = issue + latency(d.op) + (isLoad ? memCost : 0);
+	if (r.writesRd)
+	{
+		regReady[d.rd] = complete;
+	}
+	if (flags & OP_STORE)
+	{
+		forward.address = (r.address >> 2) + 1;
+		forward.ready = complete;
+	}
+
+	if (flags & OP_BRANCH)
+	{
+		bool predicted;
+		if (predictor != NULL)
+		{
+			branch_info bi;
+			bi.address = r.pc;
+			bi.opcode = 0;
+			bi.br_flags = BR_CONDITIONAL;
+			branch_update *u = predictor->predict(bi);
+			predicted = u->direction_prediction();
+			predictor->update(u, taken, r.pc + d.immediate);
+		}
+		else
+		{
+			predicted = d.immediate < 0;
+		}
+
+		branches++;
+		if (predicted != taken)
+		{
+			// nothing after the branch dispatches until it resolves
+			mispredicts++;
+			fetchResume = complete + config.mispredictPenalty;
+		}
+	}
+
+	// commit: in order, width per cycle
+	uint64_t commit = complete + 1;
+	if (commit <= commitCycle)
+	{
+		commit = commitCycle;
+		if (committedThisCycle == config.width)
+			commit++;
+	}
+	if (commit != commitCycle)
+	{
+		commitCycle = commit;
+		committedThisCycle = 0;
+	}
+	committedThisCycle++;
+
+	rob.push_back(commit);
+	if (isMemory)
+	{
+		lsq.push_back(commit);
+	}
+	instructions++;
+}
+
+void OutOfOrderModel::printStats(ostream &out)
+{
+	uint64_t cycles = instructions ? commitCycle + 1 : 0;
+	double ipc = cycles ? (double)instructions / cycles : 0;
+
+	out << "out-of-order: width " << config.width << ", ROB " << config.robSize << ", RS " << config.rsSize << ", LSQ " << config.lsqSize << endl;
+	out << "cycles: " << cycles << endl;
+	out << "instructions: " << instructions << endl;
+	out << "IPC: " << fixed << setprecision(3) << ipc << endl;
+	out << "branch mispredictions: " << mispredicts << " / " << branches << endl;
+	out << "dispatch stall cycles (ROB full): " << robStalls << endl;
+	out << "dispatch stall cycles (RS full): " << rsStalls << endl;
+	out << "dispatch stall cycles (LSQ full): " << lsqStalls << endl;
+}
@@ -0,0 +1,99 @@
+#ifndef OUTOFORDER_H
+#define OUTOFORDER_H
+
+#include "CPU.h"
+
+#include <deque>
+#include <ostream>
+#include <queue>
+#include <string>
+#include <vector>
+using namespace std;
+
+struct OooConfig
+{
+	uint32_t width;				// instructions dispatched, issued and committed per cycle
+	uint32_t robSize;			// reorder buffer entries
+	uint32_t rsSize;			// reservation station entries (shared by every unit)
+	uint32_t lsqSize;			// load/store queue entries
+	uint32_t mispredictPenalty; // cycles from a mispredicted branch resolving to the right path dispatching
+	uint32_t loadLatency;		// load-to-use cycles on a cache hit
+	uint32_t mulLatency;		// MUL/MULH*
+	uint32_t divLatency;		// DIV/REM*, not pipelined in hardware but modelled as if it were
+
+	OooConfig() : width(4), robSize(128), rsSize(32), lsqSize(32), mispredictPenalty(10), loadLatency(2), mulLatency(3), divLatency(20) {}
+};
+
+// parse "width=4,rob=128,rs=32,lsq=32,mispredict=10,load=2,mul=3,div=20" (any subset)
+bool parseOooConfig(const string &spec, OooConfig &config, string &error);
+
+// timing model of a superscalar out-of-order core, driven one instruction at
+// a time in program order by the functional stage loop (which still does all
+// the computing). each instruction gets the cycle it dispatches, issues,
+// completes and commits:
+//   - dispatch is in order, width per cycle, and waits for a free ROB, RS and
+//     (for loads/stores) LSQ entry, and for fetch to recover from a mispredict
+//   - registers are renamed, so an instruction only waits for the producers of
+//     its sources (true dependencies); stores forward to later loads of the
+//     same word
+//   - issue takes the first cycle with the operands ready and one of the
+//     width issue slots free, in any order
+//   - commit is in order, width per cycle, the cycle after completion
+class OutOfOrderModel
+{
+public:
+	OutOfOrderModel(const OooConfig &config);
+
+	// predict conditional branches with bp (the caller keeps ownership); NULL
+	// uses backward-taken/forward-not-taken
+	void setBranchPredictor(branch_predictor *bp);
+
+	// account for the next instruction. d is its decoded form, r what it did,
+	// and fetchCost/memCost the cycles the instruction/data caches charged it
+	void instruction(const DecodedInstr &d, const TraceRecord &r, bool taken, uint32_t fetchCost, uint32_t memCost);
+
+	void printStats(ostream &out);
+
+private:
+	static const uint32_t ISSUE_RING = 1 << 16; // cycles of issue slots tracked; far more than the ROB can span
+	static const uint32_t STORE_TABLE = 4096;
+
+	struct IssueSlot
+	{
+		uint64_t cycle;
+		uint32_t used;
+	};
+
+	struct StoreEntry
+	{
+		uint32_t address; // word address + 1, so 0 means empty
+		uint64_t ready;
+	};
+
+	OooConfig config;
+	branch_predictor *predictor;
+
+	uint64_t regReady[32]; // rename table: cycle each register's newest value is ready
+	deque<uint64_t> rob;   // commit cycles of the instructions still in the ROB
+	deque<uint64_t> lsq;   // commit cycles of the loads/stores in the LSQ
+	priority_queue<uint64_t, vector<uint64_t>, greater<uint64_t> > rs; // issue cycles of instructions waiting in the RS
+	vector<IssueSlot> issueSlots;
+	vector<StoreEntry> stores;
+
+	uint64_t dispatchCycle;
+	uint32_t dispatchedThisCycle;
+	uint64_t commitCycle;
+	uint32_t committedThisCycle;
+	uint64_t fetchResume; // first cycle the front end delivers again after a mispredict or miss
+
+	uint64_t instructions;
+	uint64_t branches;
+	uint64_t mispredicts;
+	uint64_t robStalls; // dispatch cycles lost waiting for each resource
+	uint64_t rsStalls;
+	uint64_t lsqStalls;
+
+	uint32_t latency(Operation op);
+};
+
+#endif
@@ -0,0 +1,153 @@
+#include "Profile.h"
+#include "CPU.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+Profile::Profile(unsigned long base, unsigned long maxPC) : base(base)
+{
+	unsigned long words = maxPC >= base ? (maxPC - base) / 4 + 1 : 0;
+	opCounts.assign(NUM_OPERATIONS, 0);
+	pcCounts.assign(words, 0);
+	taken.assign(words, 0);
+	notTaken.assign(words, 0);
+	loads.firstPage = base >> 12;
+	stores.firstPage = base >> 12;
+}
+
+// grow counter's range to take in page
+void Profile::widen(PageCounter &counter, uint32_t page)
+{
+	if (page < counter.firstPage)
+	{
+		counter.counts.insert(counter.counts.begin(), counter.firstPage - page, 0);
+		counter.firstPage = page;
+	}
+	else
+	{
+		counter.counts.resize(page - counter.firstPage + 1, 0);
+	}
+}
+
+static bool hotter(const pair<unsigned long, uint64_t> &a, const pair<unsigned long, uint64_t> &b)
+{
+	return a.second > b.second || (a.second == b.second && a.first < b.first);
+}
+
+// the most executed PCs, hottest first
+vector<pair<unsigned long, uint64_t> > Profile::hotPCs(size_t limit)
+{
+	vector<pair<unsigned long, uint64_t> > hot;
+	for (size_t i = 0; i < pcCounts.size(); i++)
+	{
+		if (pcCounts[i] != 0)
+		{
+			hot.push_back(make_pair(base + i * 4, pcCounts[i]));
+		}
+	}
+	sort(hot.begin(), hot.end(), hotter);
+	if (hot.size() > limit)
+	{
+		hot.resize(limit);
+	}
+	return hot;
+}
+
+// the pages with a non-zero count, in address order
+static vector<pair<uint32_t, uint64_t> > touchedPages(uint32_t firstPage, const vector<uint64_t> &counts)
+{
+	vector<pair<uint32_t, uint64_t> > touched;
+	for (size_t i = 0; i < counts.size(); i++)
+	{
+		if (counts[i] != 0)
+		{
+			touched.push_back(make_pair(firstPage + (uint32_t)i, counts[i]));
+		}
+	}
+	return touched;
+}
+
+static string hexString(unsigned long value)
+{
+	stringstream ss;
+	ss << "0x" << std::hex << value;
+	return ss.str();
+}
+
+void Profile::writeJSON(ostream &out)
+{
+	out << "{\n  \"operations\": {";
+	for (int op = 0; op < NUM_OPERATIONS; op++)
+	{
+		out << (op ? ", " : "") << "\"" << operationName((Operation)op) << "\": " << opCounts[op];
+	}
+	out << "},\n";
+
+	out << "  \"branches\": [";
+	bool first = true;
+	for (size_t i = 0; i < taken.size(); i++)
+	{
+		if (taken[i] == 0 && notTaken[i] == 0)
+			continue;
+		out << (first ? "\n" : ",\n") << "    {\"pc\": \"" << hexString(base + i * 4) << "\", \"taken\": " << taken[i] << ", \"not_taken\": " << notTaken[i] << "}";
+		first = false;
+	}
+	out << "\n  ],\n";
+
+	out << "  \"hot_pcs\": [";
+	vector<pair<unsigned long, uint64_t> > hot = hotPCs(32);
+	for (size_t i = 0; i < hot.size(); i++)
+	{
+		out << (i ? ",\n" : "\n") << "    {\"pc\": \"" << hexString(hot[i].first) << "\", \"count\": " << hot[i].second << "}";
+	}
+	out << "\n  ],\n";
+
+	const char *names[2] = {"load_pages", "store_pages"};
+	PageCounter *counters[2] = {&loads, &stores};
+	for (int k = 0; k < 2; k++)
+	{
+		out << "  \"" << names[k] << "\": {";
+		vector<pair<uint32_t, uint64_t> > pages = touchedPages(counters[k]->firstPage, counters[k]->counts);
+		for (size_t i = 0; i < pages.size(); i++)
+		{
+			out << (i ? ", " : "") << "\"" << hexString((unsigned long)pages[i].first << 12) << "\": " << pages[i].second;
+		}
+		out << "}" << (k == 0 ? ",\n" : "\n");
+	}
+	out << "}\n";
+}
+
+// one "kind,key,value" row per counter
+void Profile::writeCSV(ostream &out)
+{
+	out << "kind,key,value\n";
+	for (int op = 0; op < NUM_OPERATIONS; op++)
+	{
+		out << "op," << operationName((Operation)op) << "," << opCounts[op] << "\n";
+	}
+	for (size_t i = 0; i < taken.size(); i++)
+	{
+		if (taken[i] == 0 && notTaken[i] == 0)
+			continue;
+		out << "branch_taken," << hexString(base + i * 4) << "," << taken[i] << "\n";
+		out << "branch_not_taken," << hexString(base + i * 4) << "," << notTaken[i] << "\n";
+	}
+	for (size_t i = 0; i < pcCounts.size(); i++)
+	{
+		if (pcCounts[i] != 0)
+		{
+			out << "pc," << hexString(base + i * 4) << "," << pcCounts[i] << "\n";
+		}
+	}
+	vector<pair<uint32_t, uint64_t> > pages = touchedPages(loads.firstPage, loads.counts);
+	for (size_t i = 0; i < pages.size(); i++)
+	{
+		out << "load_page," << hexString((unsigned long)pages[i].first << 12) << "," << pages[i].second << "\n";
+	}
+	pages = touchedPages(stores.firstPage, stores.counts);
+	for (size_t i = 0; i < pages.size(); i++)
+	{
+		out << "store_page," << hexString((unsigned long)pages[i].first << 12) << "," << pages[i].second << "\n";
+	}
+}
@@ -0,0 +1,91 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+using namespace std;
+
+// per-run counters filled in by the CPU engines:
+//   - instructions executed per Operation
+//   - executions per PC (the hot-PC profile)
+//   - taken / not-taken counts per conditional branch
+//   - load and store counts per 4KB page of data memory
+// PC-indexed counters are flat arrays over the program. the page histograms
+// are flat arrays too, indexed by page from the program base and widened to
+// take in the lowest and highest pages touched (at most 1M pages).
+// building with -DNO_PROFILE compiles every hook in the CPU out
+class Profile
+{
+public:
+	Profile(unsigned long base, unsigned long maxPC);
+
+	void instruction(unsigned long pc, int op);
+	void branch(unsigned long pc, bool taken);
+	void load(uint32_t addr);
+	void store(uint32_t addr);
+
+	void writeJSON(ostream &out);
+	void writeCSV(ostream &out);
+
+private:
+	struct PageCounter
+	{
+		uint32_t firstPage;		// page number of counts[0]
+		vector<uint64_t> counts; // one per page from firstPage
+	};
+
+	unsigned long base;
+	vector<uint64_t> opCounts; // indexed by Operation
+	vector<uint64_t> pcCounts;
+	vector<uint64_t> taken;
+	vector<uint64_t> notTaken;
+	PageCounter loads;
+	PageCounter stores;
+
+	static void count(PageCounter &counter, uint32_t addr);
+	static void widen(PageCounter &counter, uint32_t page);
+	vector<pair<unsigned long, uint64_t> > hotPCs(size_t limit);
+};
+
+inline void Profile::instruction(unsigned long pc, int op)
+{
+	opCounts[op]++;
+	unsigned long slot = (pc - base) / 4;
+	if (slot < pcCounts.size())
+	{
+		pcCounts[slot]++;
+	}
+}
+
+inline void Profile::branch(unsigned long pc, bool wasTaken)
+{
+	unsigned long slot = (pc - base) / 4;
+	if (slot < taken.size())
+	{
+		(wasTaken ? taken : notTaken)[slot]++;
+	}
+}
+
+inline void Profile::count(PageCounter &counter, uint32_t addr)
+{
+	uint32_t page = addr >> 12;
+	// a page below firstPage wraps round to a large slot
+	if (page - counter.firstPage >= counter.counts.size())
+	{
+		widen(counter, page);
+	}
+	counter.counts[page - counter.firstPage]++;
+}
+
+inline void Profile::load(uint32_t addr)
+{
+	count(loads, addr);
+}
+
+inline void Profile::store(uint32_t addr)
+{
+	count(stores, addr);
+}
+
+#endif
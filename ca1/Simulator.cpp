@@ -0,0 +1,292 @@
+#include "Simulator.h"
+
+#include <cstring>
+#include <chrono>
+#include "../ca2/src/my_predictor.h"
+#include "../ca2/src/budget_predictor.h"
+
+bool parseSimOption(int argc, char *argv[], int &a, SimOptions &opt)
+{
+	string flag = argv[a];
+	if (flag == "--predecode")
+	{
+		opt.predecoded = true;
+	}
+	else if (flag == "--blocks")
+	{
+		opt.predecoded = true;
+		opt.blocks = true;
+	}
+	else if (flag == "--pipeline")
+	{
+		opt.pipelined = true;
+	}
+	else if (flag == "--predictor" && a + 1 < argc)
+	{
+		opt.predictorName = argv[++a];
+	}
+	else if (flag == "--max-instructions" && a + 1 < argc)
+	{
+		opt.maxInstructions = strtoul(argv[++a], NULL, 0);
+	}
+	else if (flag == "--max-cycles" && a + 1 < argc)
+	{
+		opt.maxCycles = strtoul(argv[++a], NULL, 0);
+	}
+	else if (flag == "--timeout" && a + 1 < argc)
+	{
+		opt.timeLimit = atof(argv[++a]);
+	}
+	else if (flag == "--halt-address" && a + 1 < argc)
+	{
+		opt.haltAtAddress = true;
+		opt.haltAddress = strtoul(argv[++a], NULL, 0);
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+bool loadIntoCPU(const char *path, CPU &cpu, GuestMemory &instMem, Program &prog, string &error)
+{
+	// load the program (hex bytes, raw binary or ELF) into instruction memory
+	if (!loadProgram(path, instMem, cpu.dataMemory(), prog, error))
+	{
+		return false;
+	}
+
+	// execution runs while base <= PC <= last instruction
+	if (prog.end > prog.base)
+	{
+		cpu.setPC(prog.entry);
+		cpu.setBounds(prog.base, prog.end - 4);
+	}
+	return true;
+}
+
+unsigned long instructionBudget(const SimOptions &opt, StopReason &reason)
+{
+	// the functional engines retire one instruction per cycle, so a cycle
+	// budget is an instruction budget for them
+	unsigned long limit = (unsigned long)-1;
+	reason = STOP_INSTRUCTION_LIMIT;
+	if (opt.maxInstructions != 0)
+	{
+		limit = opt.maxInstructions;
+	}
+	if (opt.maxCycles != 0 && opt.maxCycles < limit)
+	{
+		limit = opt.maxCycles;
+		reason = STOP_CYCLE_LIMIT;
+	}
+	return limit;
+}
+
+Watchdog::Watchdog(CPU &cpu, double seconds) : cpu(cpu), done(false)
+{
+	if (seconds <= 0)
+	{
+		return;
+	}
+	timer = thread([this, seconds]()
+				   {
+					   unique_lock<mutex> held(lock);
+					   if (!finished.wait_for(held, chrono::duration<double>(seconds), [this]() { return done; }))
+					   {
+						   this->cpu.requestStop();
+					   }
+				   });
+}
+
+Watchdog::~Watchdog()
+{
+	{
+		lock_guard<mutex> held(lock);
+		done = true;
+	}
+	finished.notify_one();
+	if (timer.joinable())
+	{
+		timer.join();
+	}
+}
+
+bool makePredictor(const string &name, branch_predictor *&bp, string &error)
+{
+	bp = NULL;
+	if (name == "my")
+	{
+		bp = new my_predictor();
+	}
+	else if (name.compare(0, 6, "budget") == 0)
+	{
+		// my_predictor's scheme in a storage budget (KB, 64 by default)
+		unsigned long kilobytes;
+		if (!budget_predictor::parse_spec(name.c_str(), kilobytes))
+		{
+			error = "bad predictor budget " + name + " (the smallest table needs 1 KB)";
+			return false;
+		}
+		bp = new budget_predictor(kilobytes);
+	}
+	else if (name != "none")
+	{
+		error = "unknown predictor " + name;
+		return false;
+	}
+	return true;
+}
+
+bool runProgram(CPU &cpu, GuestMemory &instMem, const Program &prog, const SimOptions &opt, string &error, TraceWriter *trace, OutOfOrderModel *ooo)
+{
+	if (prog.end <= prog.base)
+	{
+		// empty program
+		return true;
+	}
+	unsigned long base = prog.base;
+	unsigned long maxPC = prog.end - 4;
+
+	if (opt.haltAtAddress)
+	{
+		cpu.setHaltAddress(opt.haltAddress);
+	}
+	Watchdog watchdog(cpu, opt.timeLimit);
+
+	StopReason limitReason;
+	unsigned long limit = instructionBudget(opt, limitReason);
+
+	if (opt.predecoded)
+	{
+		cpu.predecode(instMem);
+	}
+
+	if (opt.pipelined)
+	{
+		branch_predictor *bp;
+		if (!makePredictor(opt.predictorName, bp, error))
+		{
+			return false;
+		}
+		cpu.setBranchPredictor(bp);
+
+		// each call is one clock cycle with up to five instructions in flight
+		bool budgeted = opt.maxInstructions != 0 || opt.maxCycles != 0;
+		while (cpu.cycle(instMem))
+		{
+			if (cpu.stopReason() == STOP_WATCHDOG)
+			{
+				break;
+			}
+			if (budgeted)
+			{
+				PipelineStats stats = cpu.pipelineStats();
+				if (opt.maxCycles != 0 && stats.cycles >= opt.maxCycles)
+				{
+					cpu.setStopReason(STOP_CYCLE_LIMIT);
+					break;
+				}
+				if (opt.maxInstructions != 0 && stats.instructions >= opt.maxInstructions)
+				{
+					cpu.setStopReason(STOP_INSTRUCTION_LIMIT);
+					break;
+				}
+			}
+		}
+		cpu.setBranchPredictor(NULL);
+		delete bp;
+		return true;
+	}
+
+	// traced and out-of-order runs always go through the stage loop below,
+	// which is the only engine that stops after every instruction
+	bool perInstruction = trace != NULL || ooo != NULL;
+	if (opt.blocks && !perInstruction)
+	{
+		unsigned long executed = cpu.runBlocks(limit);
+		if (executed >= limit && cpu.stopReason() == STOP_NONE && cpu.readPC() >= base && cpu.readPC() <= maxPC)
+		{
+			cpu.setStopReason(limitReason);
+		}
+		return true;
+	}
+
+#ifdef THREADED_DISPATCH
+	// build with -DTHREADED_DISPATCH to run on the single-dispatch engine;
+	// the stage-by-stage loop below stays the reference
+	if (!perInstruction)
+	{
+		cpu.predecode(instMem);
+		unsigned long executed = cpu.runThreaded(limit);
+		if (executed >= limit && cpu.stopReason() == STOP_NONE && cpu.readPC() >= base && cpu.readPC() <= maxPC)
+		{
+			cpu.setStopReason(limitReason);
+		}
+		return true;
+	}
+#endif
+
+	bool done = true;
+	uint32_t curr = 0;
+	unsigned long fetchCharged = cpu.fetchStallCycles();
+	unsigned long executed = 0;
+	Instruction instruction = Instruction(curr);
+
+	// processor's main loop
+	// each iteration is equal to one clock cycle
+	while (done == true)
+	{
+		unsigned long pc = cpu.readPC();
+		if (opt.predecoded)
+		{
+			// fetch and decode from the pre-decoded instruction memory
+			cpu.fetchDecoded();
+		}
+		else
+		{
+			// fetch
+			curr = cpu.fetch(instMem);
+			instruction = Instruction(curr);
+
+			cpu.decode(&instruction);
+		}
+		cpu.execute();
+		cpu.memory();
+		cpu.writeback();
+
+		if (perInstruction)
+		{
+			TraceRecord r;
+			r.pc = pc;
+			r.instr = opt.predecoded ? instMem.read32(pc) : curr;
+			cpu.retired(r);
+
+			// tracing stage: one record per retired instruction, handed to
+			// the trace writer's buffer
+			if (trace != NULL)
+			{
+				trace->record(r);
+			}
+
+			// timing stage: the out-of-order model schedules what was just executed
+			if (ooo != NULL)
+			{
+				unsigned long fetchTotal = cpu.fetchStallCycles();
+				ooo->instruction(cpu.lastDecoded(), r, cpu.readPC() != pc + 4, fetchTotal - fetchCharged, cpu.takeMemoryLatency());
+				fetchCharged = fetchTotal;
+			}
+		}
+
+		if (cpu.readPC() > maxPC || cpu.readPC() < base || cpu.stopReason() != STOP_NONE)
+			break;
+		if (++executed >= limit)
+		{
+			cpu.setStopReason(limitReason);
+			break;
+		}
+	}
+
+	return true;
+}
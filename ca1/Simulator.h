@@ -0,0 +1,70 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include "CPU.h"
+#include "Loader.h"
+#include "OutOfOrder.h"
+
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+using namespace std;
+
+// which engine cpusim runs a program on, from the command line flags
+struct SimOptions
+{
+	bool predecoded;	  // decode instruction memory once up front instead of every cycle
+	bool blocks;		  // run cached basic blocks instead of one instruction per iteration
+	bool pipelined;		  // cycle-accurate 5-stage pipeline with timing stats
+	string predictorName; // branch predictor steering fetch in the pipeline
+
+	unsigned long maxInstructions; // stop after this many instructions (0 for no limit)
+	unsigned long maxCycles;	   // stop after this many cycles; the functional engines count one per instruction
+	double timeLimit;			   // watchdog in seconds of host time (0 for none)
+	bool haltAtAddress;			   // a store to haltAddress ends the run
+	uint32_t haltAddress;
+
+	SimOptions() : predecoded(false), blocks(false), pipelined(false), predictorName("none"),
+				   maxInstructions(0), maxCycles(0), timeLimit(0), haltAtAddress(false), haltAddress(0) {}
+};
+
+// how many instructions a functional engine may run under opt's budgets
+// (all ones for no limit), and which budget that is
+unsigned long instructionBudget(const SimOptions &opt, StopReason &reason);
+
+// asks a CPU to stop from another thread once it has run for longer than
+// seconds of host time; does nothing when seconds is 0. going out of scope
+// cancels it
+class Watchdog
+{
+public:
+	Watchdog(CPU &cpu, double seconds);
+	~Watchdog();
+
+private:
+	CPU &cpu;
+	mutex lock;
+	condition_variable finished;
+	bool done;
+	thread timer;
+};
+
+// parse the engine flag at argv[a] (advancing a past its argument, if any);
+// returns false if it is not an engine flag
+bool parseSimOption(int argc, char *argv[], int &a, SimOptions &opt);
+
+// load the program at path and point the CPU at it
+bool loadIntoCPU(const char *path, CPU &cpu, GuestMemory &instMem, Program &prog, string &error);
+
+// the ca2 predictor called name ("my", or "budget:KB" for the same scheme
+// in a storage budget), or NULL for "none"; false if unknown
+bool makePredictor(const string &name, branch_predictor *&bp, string &error);
+
+// run a loaded program until PC leaves it, it stops itself (ECALL or the halt
+// address) or it runs out of budget, on the engine opt selects. with a
+// trace writer every retired instruction is recorded, and with an
+// out-of-order model every instruction is timed on it (both on the stage loop)
+bool runProgram(CPU &cpu, GuestMemory &instMem, const Program &prog, const SimOptions &opt, string &error, TraceWriter *trace = NULL, OutOfOrderModel *ooo = NULL);
+
+#endif
@@ -0,0 +1,410 @@
+#include "Trace.h"
+
+#include "../ca2/src/branch.h"
+
+#include <cstring>
+#include <fstream>
+
+static const char TRACE_MAGIC[4] = {'R', 'V', 'T', '1'};
+
+enum
+{
+	TRACE_JUMP = 1,
+	TRACE_INSTR = 2,
+	TRACE_RD = 4,
+	TRACE_MEM = 8
+};
+
+static uint32_t zigzag(int32_t v)
+{
+	return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int32_t unzigzag(uint32_t v)
+{
+	return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+TraceCodec::TraceCodec()
+{
+	lastPC = (uint32_t)-4;
+	lastAddress = 0;
+	memset(regs, 0, sizeof(regs));
+	// no real instruction is all ones, so the first sighting of each slot is written out
+	memset(words, 0xFF, sizeof(words));
+}
+
+TraceWriter::TraceWriter() : file(NULL), current(NULL), count(0), buffers(0), closing(false), failed(false)
+{
+}
+
+TraceWriter::~TraceWriter()
+{
+	string error;
+	close(error);
+}
+
+bool TraceWriter::open(const char *path, string &error)
+{
+	file = fopen(path, "wb");
+	if (file == NULL)
+	{
+		error = "error opening trace file";
+		return false;
+	}
+	failed = fwrite(TRACE_MAGIC, 1, sizeof(TRACE_MAGIC), file) != sizeof(TRACE_MAGIC);
+
+	current = new vector<uint8_t>();
+	current->reserve(BUFFER_BYTES + 32);
+	buffers = 1;
+	closing = false;
+	writer = thread(&TraceWriter::writerLoop, this);
+	return true;
+}
+
+inline void TraceWriter::putVarint(uint32_t value)
+{
+	while (value >= 0x80)
+	{
+		current->push_back((uint8_t)(value | 0x80));
+		value >>= 7;
+	}
+	current->push_back((uint8_t)value);
+}
+
+void TraceWriter::record(const TraceRecord &r)
+{
+	uint8_t flags = 0;
+	if (r.pc != lastPC + 4)
+		flags |= TRACE_JUMP;
+	if (words[slot(r.pc)] != r.instr)
+		flags |= TRACE_INSTR;
+	if (r.writesRd)
+		flags |= TRACE_RD;
+	if (r.accessesMemory)
+		flags |= TRACE_MEM;
+
+	current->push_back(flags);
+	if (flags & TRACE_JUMP)
+	{
+		putVarint(zigzag((int32_t)(r.pc - (lastPC + 4))));
+	}
+	if (flags & TRACE_INSTR)
+	{
+		for (int i = 0; i < 4; i++)
+		{
+			current->push_back((uint8_t)(r.instr >> (8 * i)));
+		}
+		words[slot(r.pc)] = r.instr;
+	}
+	if (flags & TRACE_RD)
+	{
+		current->push_back(r.rd & 0x1F);
+		putVarint(zigzag(r.rdValue - regs[r.rd & 0x1F]));
+		regs[r.rd & 0x1F] = r.rdValue;
+	}
+	if (flags & TRACE_MEM)
+	{
+		putVarint(zigzag((int32_t)(r.address - lastAddress)));
+		lastAddress = r.address;
+	}
+	lastPC = r.pc;
+	count++;
+
+	if (current->size() >= BUFFER_BYTES)
+	{
+		flushCurrent();
+	}
+}
+
+// queue the current buffer for the writer thread and carry on in a free one
+void TraceWriter::flushCurrent()
+{
+	unique_lock<mutex> guard(lock);
+	full.push_back(current);
+	ready.notify_one();
+
+	if (spare.empty() && buffers < MAX_BUFFERS)
+	{
+		buffers++;
+		current = new vector<uint8_t>();
+		current->reserve(BUFFER_BYTES + 32);
+		return;
+	}
+	// every buffer is waiting on the disk
+	freed.wait(guard, [this]()
+			   { return !spare.empty(); });
+	current = spare.back();
+	spare.pop_back();
+}
+
+void TraceWriter::writerLoop()
+{
+	unique_lock<mutex> guard(lock);
+	while (true)
+	{
+		ready.wait(guard, [this]()
+				   { return !full.empty() || closing; });
+		if (full.empty())
+		{
+			return;
+		}
+		vector<uint8_t> *buffer = full.front();
+		full.pop_front();
+
+		guard.unlock();
+		if (fwrite(buffer->data(), 1, buffer->size(), file) != buffer->size())
+		{
+			failed = true;
+		}
+		buffer->clear();
+		guard.lock();
+
+		spare.push_back(buffer);
+		freed.notify_one();
+	}
+}
+
+// write out whatever is buffered and close the file. false (with error set)
+// if any of the trace failed to reach the disk
+bool TraceWriter::close(string &error)
+{
+	if (file == NULL)
+	{
+		return true;
+	}
+	if (!current->empty())
+	{
+		flushCurrent();
+	}
+	{
+		lock_guard<mutex> guard(lock);
+		closing = true;
+		ready.notify_one();
+	}
+	writer.join();
+
+	delete current;
+	for (size_t i = 0; i < spare.size(); i++)
+	{
+		delete spare[i];
+	}
+	spare.clear();
+	if (fclose(file) != 0)
+	{
+		failed = true;
+	}
+	file = NULL;
+
+	if (failed)
+	{
+		error = "error writing trace file";
+		return false;
+	}
+	return true;
+}
+
+TraceReader::TraceReader() : file(NULL)
+{
+}
+
+TraceReader::~TraceReader()
+{
+	if (file != NULL)
+	{
+		fclose(file);
+	}
+}
+
+bool TraceReader::open(const char *path, string &error)
+{
+	file = fopen(path, "rb");
+	char magic[4];
+	if (file == NULL || fread(magic, 1, sizeof(magic), file) != sizeof(magic))
+	{
+		error = "error opening trace file";
+		return false;
+	}
+	if (memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0)
+	{
+		error = "not an execution trace";
+		return false;
+	}
+	return true;
+}
+
+bool TraceReader::getVarint(uint32_t &value)
+{
+	value = 0;
+	for (int shift = 0; shift < 35; shift += 7)
+	{
+		int c = getc(file);
+		if (c == EOF)
+		{
+			return false;
+		}
+		value |= (uint32_t)(c & 0x7F) << shift;
+		if (!(c & 0x80))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool TraceReader::next(TraceRecord &r)
+{
+	int flags = getc(file);
+	if (flags == EOF)
+	{
+		return false;
+	}
+
+	uint32_t v;
+	r.pc = lastPC + 4;
+	if (flags & TRACE_JUMP)
+	{
+		if (!getVarint(v))
+			return false;
+		r.pc += unzigzag(v);
+	}
+
+	if (flags & TRACE_INSTR)
+	{
+		uint8_t b[4];
+		if (fread(b, 1, 4, file) != 4)
+			return false;
+		words[slot(r.pc)] = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+	}
+	r.instr = words[slot(r.pc)];
+
+	r.writesRd = (flags & TRACE_RD) != 0;
+	r.rd = 0;
+	r.rdValue = 0;
+	if (r.writesRd)
+	{
+		int rd = getc(file);
+		if (rd == EOF || !getVarint(v))
+			return false;
+		r.rd = rd & 0x1F;
+		regs[r.rd] += unzigzag(v);
+		r.rdValue = regs[r.rd];
+	}
+
+	r.accessesMemory = (flags & TRACE_MEM) != 0;
+	r.address = 0;
+	if (r.accessesMemory)
+	{
+		if (!getVarint(v))
+			return false;
+		lastAddress += unzigzag(v);
+		r.address = lastAddress;
+	}
+
+	lastPC = r.pc;
+	return true;
+}
+
+// the ca2 code byte for a control transfer (0 if instr is not one); the low
+// nibble is the closest x86 condition to the RISC-V branch
+static unsigned char branchCode(uint32_t instr, bool taken)
+{
+	uint32_t opcode = instr & 0x7F;
+	uint32_t rd = (instr >> 7) & 0x1F;
+	uint32_t rs1 = (instr >> 15) & 0x1F;
+	bool link = rd == 1 || rd == 5;
+
+	if (opcode == 0x63)
+	{
+		static const unsigned char conditions[8] = {OP_JZ, OP_JNZ, OP_JZ, OP_JZ, OP_JL, OP_JGE, OP_JC, OP_JNC};
+		return (taken ? 0x10 : 0x20) | conditions[(instr >> 12) & 0x7];
+	}
+	if (opcode == 0x6F)
+	{
+		return link ? 0x50 : 0x30;
+	}
+	if (opcode == 0x67)
+	{
+		if (link)
+			return 0x60;
+		return (rd == 0 && (rs1 == 1 || rs1 == 5)) ? 0x70 : 0x40;
+	}
+	return 0;
+}
+
+// B-type immediate, so not-taken branches still report where they would have gone
+static int32_t branchOffset(uint32_t instr)
+{
+	return ((int32_t)(instr & 0x80000000) >> 19) | ((instr & 0x80) << 4) | ((instr >> 20) & 0x7E0) | ((instr >> 7) & 0x1E);
+}
+
+static void putWord(ofstream &out, uint32_t w)
+{
+	char b[4] = {(char)w, (char)(w >> 8), (char)(w >> 16), (char)(w >> 24)};
+	out.write(b, 4);
+}
+
+bool convertTrace(const char *tracePath, const string &format, const char *outPath, unsigned core, unsigned lineBytes, string &error)
+{
+	if (format != "ca2" && format != "ca3")
+	{
+		error = "unknown trace format " + format;
+		return false;
+	}
+	if (lineBytes == 0)
+	{
+		error = "line size must be non-zero";
+		return false;
+	}
+
+	TraceReader reader;
+	if (!reader.open(tracePath, error))
+	{
+		return false;
+	}
+	ofstream out(outPath, format == "ca2" ? ios::binary : ios::out);
+	if (!out.is_open())
+	{
+		error = "error opening output file";
+		return false;
+	}
+
+	TraceRecord r, next;
+	bool have = reader.next(r);
+	while (have)
+	{
+		bool haveNext = reader.next(next);
+
+		if (format == "ca3")
+		{
+			if (r.accessesMemory)
+			{
+				// stores and AMOs both need the line exclusively
+				out << "P" << core << ": " << ((r.instr & 0x7F) == 0x03 ? "read" : "write") << " <" << r.address / lineBytes << ">\n";
+			}
+		}
+		else if (haveNext)
+		{
+			// direction and target come from where execution went next;
+			// the final branch of a run has nothing after it and is dropped
+			unsigned char code = branchCode(r.instr, next.pc != r.pc + 4);
+			if (code != 0)
+			{
+				out.put((char)code);
+				putWord(out, r.pc);
+				putWord(out, (r.instr & 0x7F) == 0x63 ? r.pc + branchOffset(r.instr) : next.pc);
+			}
+		}
+
+		r = next;
+		have = haveNext;
+	}
+
+	out.close();
+	if (out.fail())
+	{
+		error = "error writing output file";
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,114 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// one retired instruction
+struct TraceRecord
+{
+	uint32_t pc;
+	uint32_t instr;		// raw instruction word
+	bool writesRd;
+	uint8_t rd;
+	int32_t rdValue;	// value written to rd
+	bool accessesMemory;
+	uint32_t address;	// load/store address
+};
+
+// binary execution trace. the file starts with the 4-byte magic "RVT1" and
+// then holds one variable-length record per retired instruction:
+//   flags byte: bit 0 PC is not the previous PC + 4
+//               bit 1 instruction word follows
+//               bit 2 rd and its value follow
+//               bit 3 memory address follows
+//   [zigzag varint] PC - (previous PC + 4)
+//   [4 bytes]       instruction word, little endian; left out when it matches
+//                   the word last seen at the same slot of a 1024-entry
+//                   PC-indexed table that the reader keeps in step
+//   [1 byte + zigzag varint] rd, then new value - rd's previous traced value
+//   [zigzag varint] address - previous traced address
+// straight-line code with a hot loop usually costs 1-3 bytes per instruction
+class TraceCodec
+{
+protected:
+	uint32_t lastPC;
+	uint32_t lastAddress;
+	int32_t regs[32];
+	uint32_t words[1024];
+
+	TraceCodec();
+	static unsigned slot(uint32_t pc) { return (pc >> 2) & 1023; }
+};
+
+// encodes records into large buffers and hands full buffers to a background
+// thread that writes them out, so the simulation loop only ever appends bytes
+// to memory. a few buffers are kept in flight; the loop waits only when the
+// disk falls behind all of them. a write error is kept until close reports it
+class TraceWriter : private TraceCodec
+{
+public:
+	TraceWriter();
+	~TraceWriter();
+
+	bool open(const char *path, string &error);
+	void record(const TraceRecord &r);
+	bool close(string &error); // false if any write failed
+
+	uint64_t records() const { return count; }
+
+private:
+	static const size_t BUFFER_BYTES = 1 << 20;
+	static const size_t MAX_BUFFERS = 4;
+
+	FILE *file;
+	vector<uint8_t> *current;
+	uint64_t count;
+
+	thread writer;
+	mutex lock;
+	condition_variable ready; // a full buffer is queued, or closing
+	condition_variable freed; // a buffer came back from the writer
+	deque<vector<uint8_t> *> full;
+	vector<vector<uint8_t> *> spare;
+	size_t buffers;
+	bool closing;
+	bool failed; // a write or the close failed; set by the writer thread until it exits
+
+	void putVarint(uint32_t value);
+	void flushCurrent();
+	void writerLoop();
+};
+
+// decodes a trace written by TraceWriter
+class TraceReader : private TraceCodec
+{
+public:
+	TraceReader();
+	~TraceReader();
+
+	bool open(const char *path, string &error);
+	bool next(TraceRecord &r); // false at end of file (or on a truncated record)
+
+private:
+	FILE *file;
+
+	bool getVarint(uint32_t &value);
+};
+
+// convert a trace for the other tools in this repo:
+//   "ca2": 9-byte branch records for ca2's predict (BEQ, JAL and JALR). a
+//          branch's direction comes from the record after it, so the last
+//          branch of a run, with nothing after it, is left out
+//   "ca3": "P<core>: read|write <tag>" lines for ca3's coherentsim, with
+//          tag = address / lineBytes
+bool convertTrace(const char *tracePath, const string &format, const char *outPath, unsigned core, unsigned lineBytes, string &error);
+
+#endif
@@ -0,0 +1,244 @@
+#include "../Simulator.h"
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// throughput of each engine on a fixed set of kernels, to see whether a change
+// to the simulator made it faster or slower before it goes in. every
+// kernel/engine pair runs in its own process, so peak RSS is that run's alone.
+//
+// g++ -O2 -pthread -o cpubench bench/cpubench.cpp $(ls *.cpp | grep -v cpusim.cpp)   (from ca1)
+// ./cpubench [--engines stage,predecode,blocks,threaded,pipeline] [--repeat N] [--json out.json] [kernel ...]
+//
+// the kernels in bench/kernels are ordinary hex programs:
+//   alu            add/xor/shift/mul chain, 1.5M iterations of 10 instructions
+//   memcpy         16KB buffer copied 1024 times, LW/SW unrolled by four
+//   branchy        an LCG steering three data-dependent branches per iteration
+//   pointer_chase  4M dependent loads round a 4096-node list, one node per 64 bytes
+// a0/a1 of every engine are checked against the first engine's
+
+struct BenchResult
+{
+	bool ok;
+	unsigned long instructions;
+	double seconds; // fastest of the repeats
+	int32_t a0;
+	int32_t a1;
+	long peakRSS; // KB
+};
+
+// run kernel once on engine in this process
+static bool runOnce(const string &kernel, const string &engine, BenchResult &r, string &error)
+{
+	CPU cpu;
+	GuestMemory instMem;
+	Program prog;
+	if (!loadIntoCPU(kernel.c_str(), cpu, instMem, prog, error))
+	{
+		return false;
+	}
+
+	SimOptions opt;
+	opt.predecoded = engine == "predecode" || engine == "blocks";
+	opt.blocks = engine == "blocks";
+	opt.pipelined = engine == "pipeline";
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	if (engine == "threaded")
+	{
+		// the single-dispatch engine is only behind a build flag in cpusim
+		cpu.predecode(instMem);
+		cpu.runThreaded((unsigned long)-1);
+	}
+	else if (!runProgram(cpu, instMem, prog, opt, error))
+	{
+		return false;
+	}
+	r.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	r.instructions = cpu.instructionsRetired();
+	r.a0 = cpu.readReg(10);
+	r.a1 = cpu.readReg(11);
+	return true;
+}
+
+// run kernel repeat times on engine in a child process, keeping the fastest
+static BenchResult runChild(const string &kernel, const string &engine, unsigned repeat, string &error)
+{
+	BenchResult r;
+	r.ok = false;
+	int fds[2];
+	if (pipe(fds) != 0)
+	{
+		error = "cannot create a pipe";
+		return r;
+	}
+
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		close(fds[0]);
+		BenchResult best;
+		best.ok = true;
+		for (unsigned i = 0; i < repeat && best.ok; i++)
+		{
+			BenchResult run;
+			string childError;
+			best.ok = runOnce(kernel, engine, run, childError);
+			if (best.ok && (i == 0 || run.seconds < best.seconds))
+			{
+				best = run;
+				best.ok = true;
+			}
+		}
+		ssize_t written = write(fds[1], &best, sizeof(best));
+		_exit(written == (ssize_t)sizeof(best) ? 0 : 1);
+	}
+	close(fds[1]);
+	if (pid < 0)
+	{
+		close(fds[0]);
+		error = "cannot fork";
+		return r;
+	}
+
+	ssize_t got = read(fds[0], &r, sizeof(r));
+	close(fds[0]);
+	int status;
+	struct rusage usage;
+	wait4(pid, &status, 0, &usage);
+	if (got != (ssize_t)sizeof(r) || !r.ok)
+	{
+		r.ok = false;
+		error = "cannot run " + kernel + " on " + engine;
+		return r;
+	}
+#ifdef __APPLE__
+	r.peakRSS = usage.ru_maxrss / 1024; // bytes there, KB on Linux
+#else
+	r.peakRSS = usage.ru_maxrss;
+#endif
+	return r;
+}
+
+static string kernelName(const string &path)
+{
+	size_t slash = path.find_last_of('/');
+	string name = slash == string::npos ? path : path.substr(slash + 1);
+	size_t dot = name.find_last_of('.');
+	return dot == string::npos ? name : name.substr(0, dot);
+}
+
+int main(int argc, char *argv[])
+{
+	vector<string> engines;
+	vector<string> kernels;
+	unsigned repeat = 3;
+	string jsonPath; // stdout when empty
+	for (int a = 1; a < argc; a++)
+	{
+		string flag = argv[a];
+		if (flag == "--engines" && a + 1 < argc)
+		{
+			stringstream list(argv[++a]);
+			string engine;
+			while (getline(list, engine, ','))
+			{
+				if (engine != "stage" && engine != "predecode" && engine != "blocks" && engine != "threaded" && engine != "pipeline")
+				{
+					cout << "unknown engine " << engine << "\n";
+					return -1;
+				}
+				engines.push_back(engine);
+			}
+		}
+		else if (flag == "--repeat" && a + 1 < argc)
+		{
+			repeat = atoi(argv[++a]);
+		}
+		else if (flag == "--json" && a + 1 < argc)
+		{
+			jsonPath = argv[++a];
+		}
+		else if (flag.compare(0, 2, "--") == 0)
+		{
+			cout << "unknown option " << flag << "\n";
+			return -1;
+		}
+		else
+		{
+			kernels.push_back(flag);
+		}
+	}
+	if (engines.empty())
+	{
+		const char *all[] = {"stage", "predecode", "blocks", "threaded", "pipeline"};
+		engines.assign(all, all + 5);
+	}
+	if (kernels.empty())
+	{
+		const char *all[] = {"bench/kernels/alu.txt", "bench/kernels/memcpy.txt", "bench/kernels/branchy.txt", "bench/kernels/pointer_chase.txt"};
+		kernels.assign(all, all + 4);
+	}
+	if (repeat == 0)
+	{
+		repeat = 1;
+	}
+
+	stringstream json;
+	json << "{\n  \"repeat\": " << repeat << ",\n  \"results\": [";
+	bool allMatch = true;
+	bool first = true;
+	for (size_t k = 0; k < kernels.size(); k++)
+	{
+		BenchResult reference;
+		reference.ok = false;
+		for (size_t e = 0; e < engines.size(); e++)
+		{
+			string error;
+			BenchResult r = runChild(kernels[k], engines[e], repeat, error);
+			if (!r.ok)
+			{
+				cout << error << "\n";
+				return -1;
+			}
+			if (!reference.ok)
+			{
+				reference = r;
+			}
+			bool matches = r.a0 == reference.a0 && r.a1 == reference.a1;
+			allMatch = allMatch && matches;
+
+			double mips = r.instructions / r.seconds / 1e6;
+			double ns = r.seconds * 1e9 / r.instructions;
+			cerr << left << setw(14) << kernelName(kernels[k]) << setw(10) << engines[e] << right
+				 << setw(10) << r.instructions << " instr " << fixed << setprecision(1) << setw(8) << mips << " MIPS "
+				 << setprecision(2) << setw(7) << ns << " ns/instr " << setw(7) << r.peakRSS << " KB"
+				 << (matches ? "" : "  MISMATCH") << endl;
+
+			json << (first ? "\n" : ",\n") << "    {\"kernel\": \"" << kernelName(kernels[k]) << "\", \"engine\": \"" << engines[e]
+				 << "\", \"instructions\": " << r.instructions << ", \"seconds\": " << fixed << setprecision(6) << r.seconds
+				 << ", \"mips\": " << setprecision(3) << mips << ", \"ns_per_instruction\": " << ns
+				 << ", \"peak_rss_kb\": " << r.peakRSS << ", \"a0\": " << r.a0 << ", \"a1\": " << r.a1
+				 << ", \"matches\": " << (matches ? "true" : "false") << "}";
+			first = false;
+		}
+	}
+	json << "\n  ]\n}\n";
+
+	if (jsonPath.empty())
+	{
+		cout << json.str();
+	}
+	else
+	{
+		ofstream out(jsonPath.c_str());
+		out << json.str();
+	}
+	return allMatch ? 0 : 1;
+}
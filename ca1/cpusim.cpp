@@ -1,12 +1,16 @@
 #include "CPU.h"
+#include "Simulator.h"
+#include "Batch.h"
+#include "MultiHart.h"
+#include "Trace.h"
 
 #include <iostream>
 #include <bitset>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
+#include <thread>
 #include <fstream>
-#include <sstream>
 using namespace std;
 
 int main(int argc, char *argv[])
@@ -21,7 +25,22 @@ int main(int argc, char *argv[])
 	Each line in the input file is stored as an hex and is 1 byte (each four lines are one instruction). You need to read the file line by line and store it into the memory. You may need a mechanism to convert these values to bits so that you can read opcodes, operands, etc.
 	*/
 
-	bitset<8> instMem[4096];
+	// g++ -O2 -pthread *.cpp -o cpusim   (add -DTHREADED_DISPATCH for the single-dispatch engine)
+	// ./cpusim <program> [--predecode | --blocks | --pipeline [--predictor my|budget:KB]] [--profile out.json|out.csv]
+	// ./cpusim --batch <manifest> [engine flags] [--threads N]
+	// ./cpusim <program> --trace out.trace   (binary record per retired instruction)
+	// ./cpusim <program> --fast-forward N --checkpoint out.ckpt
+	// ./cpusim <program> --restore in.ckpt [engine flags]
+	// ./cpusim <program> --dcache size=32K,ways=8,line=64,policy=lru|plru,write=wb|wt,miss=20,wpen=10
+	// ./cpusim <program> --icache <same options> [--fetch-buffer]
+	// ./cpusim <program> --ooo width=4,rob=128,rs=32,lsq=32,mispredict=10,load=2,mul=3,div=20 [--predictor my]
+	// ./cpusim --convert-trace <trace> ca2|ca3 <out> [--core N] [--line-bytes N]
+	//   (ca2 leaves out the run's last branch: its direction is never known)
+	// ./cpusim <program> --harts N [--quantum N] [--coherence] [engine flags]
+	// engine flags also take --max-instructions N --max-cycles N --timeout S --halt-address A
+
+	// instruction memory, paged in as the program is loaded
+	GuestMemory instMem;
 
 	if (argc < 2)
 	{
@@ -29,50 +48,327 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
-	// open the file
-	ifstream infile(argv[1]);
-	if (!(infile.is_open() && infile.good()))
+	if (string(argv[1]) == "--convert-trace")
+	{
+		// turn a trace into ca2 branch records or ca3 coherence requests
+		if (argc < 5)
+		{
+			cout << "usage: --convert-trace <trace> ca2|ca3 <out> [--core N] [--line-bytes N]\n";
+			cout << "ca2 leaves out the last branch of the run, whose direction the trace never shows\n";
+			return -1;
+		}
+		unsigned core = 1;
+		unsigned lineBytes = 64;
+		for (int a = 5; a + 1 < argc; a += 2)
+		{
+			if (string(argv[a]) == "--core")
+				core = atoi(argv[a + 1]);
+			else if (string(argv[a]) == "--line-bytes")
+				lineBytes = atoi(argv[a + 1]);
+		}
+		string error;
+		if (!convertTrace(argv[2], argv[3], argv[4], core, lineBytes, error))
+		{
+			cout << error << "\n";
+			return -1;
+		}
+		return 0;
+	}
+
+	// optional flags after the program file (or after --batch <manifest>)
+	SimOptions opt;
+	bool batch = false;
+	unsigned threads = thread::hardware_concurrency();
+	string profilePath; // write per-run counters here (.csv for CSV, anything else JSON)
+	string tracePath;	// write an execution trace here
+	string restorePath; // start from this checkpoint instead of the program entry
+	string checkpointPath;
+	unsigned long fastForward = 0; // instructions to run before writing checkpointPath
+	bool fastForwarding = false;	   // --fast-forward was given
+	string dcacheSpec;			   // data cache geometry, empty for zero-latency memory
+	string icacheSpec;			   // instruction cache geometry, empty for perfect fetch
+	bool fetchBuffer = false;	   // fetch a whole line at a time from the instruction cache
+	string oooSpec;				   // time the run on an out-of-order core with this shape
+	HartOptions harts;			   // more than one hart (or coherence) runs the program multi-threaded
+	int first = 2;
+	if (string(argv[1]) == "--batch" && argc > 2)
+	{
+		batch = true;
+		first = 3;
+	}
+	for (int a = first; a < argc; a++)
+	{
+		string flag = argv[a];
+		if (parseSimOption(argc, argv, a, opt))
+		{
+			continue;
+		}
+		else if (flag == "--profile" && a + 1 < argc)
+		{
+			profilePath = argv[++a];
+		}
+		else if (flag == "--trace" && a + 1 < argc)
+		{
+			tracePath = argv[++a];
+		}
+		else if (flag == "--dcache" && a + 1 < argc)
+		{
+			dcacheSpec = argv[++a];
+		}
+		else if (flag == "--icache" && a + 1 < argc)
+		{
+			icacheSpec = argv[++a];
+		}
+		else if (flag == "--fetch-buffer")
+		{
+			fetchBuffer = true;
+		}
+		else if (flag == "--ooo" && a + 1 < argc)
+		{
+			oooSpec = argv[++a];
+		}
+		else if (flag == "--restore" && a + 1 < argc)
+		{
+			restorePath = argv[++a];
+		}
+		else if (flag == "--checkpoint" && a + 1 < argc)
+		{
+			checkpointPath = argv[++a];
+		}
+		else if (flag == "--fast-forward" && a + 1 < argc)
+		{
+			fastForward = strtoul(argv[++a], NULL, 0);
+			fastForwarding = true;
+		}
+		else if (flag == "--threads" && a + 1 < argc)
+		{
+			threads = atoi(argv[++a]);
+		}
+		else if (flag == "--harts" && a + 1 < argc)
+		{
+			harts.harts = atoi(argv[++a]);
+		}
+		else if (flag == "--quantum" && a + 1 < argc)
+		{
+			harts.quantum = strtoul(argv[++a], NULL, 0);
+		}
+		else if (flag == "--coherence")
+		{
+			harts.coherence = true;
+		}
+		else
+		{
+			cout << "unknown option " << flag << "\n";
+			return -1;
+		}
+	}
+
+	if (!tracePath.empty() && (batch || opt.pipelined))
+	{
+		cout << "--trace needs a single run on a functional engine\n";
+		return -1;
+	}
+	if ((!dcacheSpec.empty() || !icacheSpec.empty()) && batch)
+	{
+		cout << "--dcache and --icache need a single run\n";
+		return -1;
+	}
+	if (!oooSpec.empty() && (batch || opt.pipelined))
+	{
+		cout << "--ooo needs a single run without --pipeline\n";
+		return -1;
+	}
+	if (fetchBuffer && icacheSpec.empty())
+	{
+		cout << "--fetch-buffer needs --icache\n";
+		return -1;
+	}
+	if (fastForwarding && checkpointPath.empty())
+	{
+		// there is nowhere for the fast-forwarded state to go
+		cout << "--fast-forward needs --checkpoint\n";
+		return -1;
+	}
+
+	bool multiHart = harts.harts != 1 || harts.coherence;
+	if (multiHart && (batch || !tracePath.empty() || !profilePath.empty() || !dcacheSpec.empty() || !icacheSpec.empty() ||
+					  !oooSpec.empty() || !restorePath.empty() || !checkpointPath.empty()))
+	{
+		cout << "--harts and --coherence only take engine flags\n";
+		return -1;
+	}
+
+	string error;
+	if (multiHart)
 	{
-		cout << "error opening file\n";
+		// one CPU per hart, each on its own thread, over shared data memory
+		if (!runHarts(argv[1], opt, harts, error))
+		{
+			cout << error << "\n";
+			return -1;
+		}
 		return 0;
 	}
-	string line;
-	int i = 0;
-	while (infile)
+
+	if (batch)
 	{
-		infile >> line;
-		stringstream line2(line);
-		int x;
-		line2 >> std::hex >> x;
-		instMem[i] = bitset<8>(x);
-		i++;
+		// run every program in the manifest, spread over a pool of threads
+		if (!runBatch(argv[2], opt, threads, error))
+		{
+			cout << error << "\n";
+			return -1;
+		}
+		return 0;
 	}
-	int maxPC = i;
 
 	CPU myCPU;
+	Program prog;
+	if (!loadIntoCPU(argv[1], myCPU, instMem, prog, error))
+	{
+		cout << error << "\n";
+		return 0;
+	}
+
+	if (!restorePath.empty() && !myCPU.restoreCheckpoint(restorePath.c_str(), error))
+	{
+		cout << error << "\n";
+		return -1;
+	}
+
+	if (!checkpointPath.empty())
+	{
+		// fast-forward on the block engine with nothing attached, then save
+		// the state for detailed runs to start from
+		myCPU.predecode(instMem);
+		unsigned long executed = myCPU.runBlocks(fastForward);
+		if (!myCPU.saveCheckpoint(checkpointPath.c_str(), error))
+		{
+			cout << error << "\n";
+			return -1;
+		}
+		cerr << "checkpoint after " << executed << " instructions" << endl;
+		myCPU.printRegs();
+		return 0;
+	}
+
+	CacheModel *dcache = NULL;
+	if (!dcacheSpec.empty())
+	{
+		CacheConfig config;
+		if (!parseCacheConfig(dcacheSpec, config, error))
+		{
+			cout << error << "\n";
+			return -1;
+		}
+		dcache = new CacheModel(config);
+		myCPU.setDataCache(dcache);
+	}
+
+	CacheModel *icache = NULL;
+	if (!icacheSpec.empty())
+	{
+		CacheConfig config;
+		if (!parseCacheConfig(icacheSpec, config, error))
+		{
+			cout << error << "\n";
+			return -1;
+		}
+		icache = new CacheModel(config);
+		myCPU.setInstructionCache(icache, fetchBuffer);
+	}
+
+	OutOfOrderModel *ooo = NULL;
+	branch_predictor *oooPredictor = NULL;
+	if (!oooSpec.empty())
+	{
+		OooConfig config;
+		if (!parseOooConfig(oooSpec, config, error) || !makePredictor(opt.predictorName, oooPredictor, error))
+		{
+			cout << error << "\n";
+			return -1;
+		}
+		ooo = new OutOfOrderModel(config);
+		ooo->setBranchPredictor(oooPredictor);
+	}
+
+	Profile *profile = NULL;
+	if (!profilePath.empty())
+	{
+		profile = new Profile(prog.base, prog.end > prog.base ? prog.end - 4 : prog.base);
+		myCPU.setProfile(profile);
+	}
 
-	bool done = true;
-	bitset<32> curr;
-	Instruction instruction = Instruction(curr);
+	TraceWriter *trace = NULL;
+	if (!tracePath.empty())
+	{
+		trace = new TraceWriter();
+		if (!trace->open(tracePath.c_str(), error))
+		{
+			cout << error << "\n";
+			return -1;
+		}
+	}
 
-	// processor's main loop
-	// each iteration is equal to one clock cycle
-	while (done == true)
+	if (!runProgram(myCPU, instMem, prog, opt, error, trace, ooo))
 	{
-		// fetch
-		curr = myCPU.fetch(instMem);
-		instruction = Instruction(curr);
+		cout << error << "\n";
+		return -1;
+	}
 
-		myCPU.decode(&instruction);
-		myCPU.execute();
-		myCPU.memory();
-		myCPU.writeback();
+	if (trace != NULL)
+	{
+		bool written = trace->close(error);
+		delete trace;
+		if (!written)
+		{
+			cout << error << "\n";
+			return -1;
+		}
+	}
 
-		if (myCPU.readPC() > maxPC)
-			break;
+	if (profile != NULL)
+	{
+		ofstream out(profilePath.c_str());
+		if (profilePath.size() > 4 && profilePath.compare(profilePath.size() - 4, 4, ".csv") == 0)
+			profile->writeCSV(out);
+		else
+			profile->writeJSON(out);
+		myCPU.setProfile(NULL);
+		delete profile;
 	}
 
 	myCPU.printRegs();
+	if (myCPU.stopReason() != STOP_NONE)
+	{
+		cerr << "stopped: " << stopReasonName(myCPU.stopReason()) << endl;
+	}
+	if (opt.pipelined)
+	{
+		myCPU.printPipelineStats();
+	}
+	if (ooo != NULL)
+	{
+		ooo->printStats(cerr);
+		delete ooo;
+		delete oooPredictor;
+	}
+	if (dcache != NULL)
+	{
+		// with the pipeline the stall cycles are already part of the cycle count above
+		dcache->printStats(cerr, "dcache");
+		myCPU.setDataCache(NULL);
+		delete dcache;
+	}
+	if (icache != NULL)
+	{
+		icache->printStats(cerr, "icache");
+		if (fetchBuffer)
+		{
+			cerr << "fetch buffer hits: " << myCPU.fetchBufferHits() << endl;
+		}
+		myCPU.setInstructionCache(NULL, false);
+		delete icache;
+	}
 
 	return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,28 @@
+# three data-dependent branches per iteration of an LCG, 256 iterations:
+# enough mispredictions behind predictor stalls to check the pipeline's
+# cycle breakdown
+    addi s0, zero, 256
+    addi a0, zero, 0
+    addi a1, zero, 1234
+    lui t3, 0x196
+    addi t3, t3, 0x60d
+loop:
+    mul a1, a1, t3
+    addi a1, a1, 1013
+    srli t0, a1, 16
+    andi t1, t0, 1
+    beq t1, zero, skip1
+    addi a0, a0, 1
+skip1:
+    andi t1, t0, 6
+    bne t1, zero, skip2
+    addi a0, a0, 3
+skip2:
+    blt a1, zero, neg
+    xori a0, a0, 5
+    jal zero, join
+neg:
+    addi a0, a0, -1
+join:
+    addi s0, s0, -1
+    bne s0, zero, loop
@@ -0,0 +1,13 @@
+# a conditional branch straight after a JALR: the pipeline fetches (and
+# predicts) the branch before the JALR redirects past it
+    addi a0, x0, 0
+    addi a1, x0, 0
+    jal ra, f
+    addi a1, a1, 0
+    jal x0, done
+f:
+    addi a0, a0, 1
+    jalr x0, 0(ra)
+    beq a0, a0, f
+done:
+    addi a0, a0, 2
@@ -0,0 +1,43 @@
+#!/bin/sh
+# run every test program on each engine and compare the a0/a1 line with
+# <name>-GT.txt. on the pipeline, also check that the cycle breakdown adds
+# up to the cycle count without any category going negative
+#
+# tests/run_tests.sh ./cpusim   (from ca1)
+# <name>.s is the source of <name>.txt/<name>.elf, for reading only
+
+sim=${1:-./cpusim}
+dir=$(dirname "$0")
+failed=0
+stats=$(mktemp)
+trap 'rm -f "$stats"' EXIT
+
+for expected in "$dir"/*-GT.txt; do
+	name=${expected%-GT.txt}
+	program=$name.txt
+	[ -f "$program" ] || program=$name.elf
+	for engine in "" "--predecode" "--blocks" "--pipeline" "--pipeline --predictor budget:4"; do
+		# a hang is a failure too
+		got=$(timeout 10 "$sim" "$program" $engine 2>"$stats")
+		if [ "$got" != "$(cat "$expected")" ]; then
+			echo "FAIL $(basename "$name") ${engine:-(stage)}: got '$got'"
+			failed=1
+		fi
+		case "$engine" in
+		--pipeline*)
+			# every line but CPI and mispredictions is a share of the cycles
+			if ! awk -F': ' '
+				/^cycles:/ { cycles = $2; next }
+				/^CPI:|^branch mispredictions:/ { next }
+				{ sum += $2; if ($2 > cycles) bad = 1 }
+				END { exit !(cycles > 0 && sum == cycles && !bad) }' "$stats"; then
+				echo "FAIL $(basename "$name") $engine: cycle breakdown does not add up"
+				failed=1
+			fi
+			;;
+		esac
+	done
+done
+
+[ $failed -eq 0 ] && echo "all tests passed"
+exit $failed
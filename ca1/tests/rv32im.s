@@ -0,0 +1,128 @@
+# known answers for the corners of RV32IM that the engines could get wrong
+# together: division by zero and overflow, the high multiplies, sign and
+# zero extension on loads, SLTIU with a negative immediate and the shift
+# encodings. every check compares against the value the ISA manual gives;
+# a0 ends as 0 with a1 the number of checks passed, or a0 is the number of
+# the first check that failed
+#
+# llvm-mc -triple=riscv32 -mattr=+m,-relax -filetype=obj rv32im.s -o rv32im.o
+# llvm-objcopy -O binary -j .text rv32im.o rv32im.bin   (then one hex byte per line)
+
+    .macro check id, reg, value
+    li t6, \value
+    li a0, \id
+    bne \reg, t6, fail
+    addi a1, a1, 1
+    .endm
+
+    li sp, 0x10000
+    li a1, 0
+    li t0, -7
+    li t1, 3
+    li t3, 0
+    li t4, 0x80000000
+    li t5, -1
+
+    # division, including by zero and INT_MIN / -1
+    div t2, t0, t1
+    check 1, t2, -2
+    rem t2, t0, t1
+    check 2, t2, -1
+    divu t2, t0, t1
+    check 3, t2, 0x55555553
+    remu t2, t0, t1
+    check 4, t2, 0
+    div t2, t0, t3
+    check 5, t2, -1
+    rem t2, t0, t3
+    check 6, t2, -7
+    divu t2, t0, t3
+    check 7, t2, 0xffffffff
+    remu t2, t0, t3
+    check 8, t2, -7
+    div t2, t4, t5
+    check 9, t2, 0x80000000
+    rem t2, t4, t5
+    check 10, t2, 0
+    divu t2, t4, t5
+    check 11, t2, 0
+    remu t2, t4, t5
+    check 12, t2, 0x80000000
+
+    # multiplies, low and high halves
+    mul t2, t0, t1
+    check 13, t2, -21
+    mulh t2, t0, t0
+    check 14, t2, 0
+    mulh t2, t4, t4
+    check 15, t2, 0x40000000
+    mulh t2, t0, t1
+    check 16, t2, -1
+    mulhu t2, t5, t5
+    check 17, t2, 0xfffffffe
+    mulhu t2, t0, t1
+    check 18, t2, 2
+    mulhsu t2, t5, t5
+    check 19, t2, -1
+    mulhsu t2, t1, t5
+    check 20, t2, 2
+    mulhsu t2, t4, t1
+    check 21, t2, -2
+
+    # loads: sign extension for LB/LH, zero extension for LBU/LHU
+    li t2, 0x80ff7f01
+    sw t2, 0(sp)
+    lb t2, 0(sp)
+    check 22, t2, 1
+    lb t2, 1(sp)
+    check 23, t2, 127
+    lb t2, 2(sp)
+    check 24, t2, -1
+    lbu t2, 2(sp)
+    check 25, t2, 255
+    lh t2, 0(sp)
+    check 26, t2, 0x7f01
+    lh t2, 2(sp)
+    check 27, t2, -32513
+    lhu t2, 2(sp)
+    check 28, t2, 0x80ff
+    lbu t2, 3(sp)
+    check 29, t2, 0x80
+
+    # comparisons against sign-extended immediates
+    sltiu t2, t1, -1
+    check 30, t2, 1
+    sltiu t2, t5, -1
+    check 31, t2, 0
+    sltiu t2, t3, 1
+    check 32, t2, 1
+    slti t2, t0, -8
+    check 33, t2, 0
+    sltu t2, t0, t1
+    check 34, t2, 0
+    slt t2, t0, t1
+    check 35, t2, 1
+
+    # shifts: immediate encodings up to 31, register amounts use 5 bits
+    srai t2, t0, 1
+    check 36, t2, -4
+    srli t2, t0, 28
+    check 37, t2, 0xf
+    srai t2, t4, 31
+    check 38, t2, -1
+    srli t2, t4, 31
+    check 39, t2, 1
+    slli t2, t1, 30
+    check 40, t2, 0xc0000000
+    slli t2, t1, 31
+    check 41, t2, 0x80000000
+    li t3, 33
+    sra t2, t0, t3
+    check 42, t2, -4
+    srl t2, t4, t3
+    check 43, t2, 0x40000000
+    sll t2, t1, t3
+    check 44, t2, 6
+
+    li a0, 0
+fail:
@@ -0,0 +1,6 @@
+# one read/execute PT_LOAD segment at 0x10000: the code loads a constant
+# stored after it in the same segment, as .rodata and literal pools are
+    auipc t0, 0
+    lw a0, 12(t0)
+    jal x0, 8
+    .word 0x12345678
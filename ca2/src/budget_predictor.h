@@ -0,0 +1,271 @@
+// budget_predictor.h
+// The my_predictor scheme sized to a hardware storage budget. my_predictor
+// keeps four separate 1 << 30 entry tables (about 13 GB); here the four
+// per-entry fields are packed into one byte, so everything the predictor
+// reads or writes at an index is in the same cache line, and the number of
+// entries is the largest power of two that fits the budget, which must hold
+// at least the smallest table (parse_spec checks this).  predict_batch
+// is native: it skips the virtual calls and prefetches the entries of
+// branches a few ahead, whose histories are known from the outcomes given.
+
+class budget_update : public branch_update
+{
+public:
+	unsigned int index;
+};
+
+// What a conditional prediction read, for training on its outcome
+struct budget_lookup
+{
+	unsigned int u_index; // Entry the prediction came from
+	unsigned int index;	  // Entry the selector fields were read from
+	bool prediction;
+	bool global_vs_local[2];
+	bool short_vs_medium_long[3];
+};
+
+class budget_predictor : public branch_predictor
+{
+public:
+#define BUDGET_GLOBAL_HISTORY_LENGTH 30 // Global history length, cut to the table index width for small budgets
+#define BUDGET_SHORT_HISTORY_LENGTH 2
+#define BUDGET_MEDIUM_HISTORY_LENGTH 8
+#define BUDGET_MIN_TABLE_BITS 8			// Medium history has to fit in the index
+#define BUDGET_PREFETCH_DISTANCE 8		// Branches ahead predict_batch prefetches for
+#define BUDGET_PREFETCH_MIN_BITS 21		// Tables under 2 MB stay in cache well enough without it
+
+// One entry:  bits 0-2 counter (0-7, predicts taken from 4),
+//             bit 3 accuracy (1 when the combined history was right),
+//             bits 4-5 history preference, bits 6-7 previous preference
+#define COUNTER_MASK 0x07
+#define ACCURACY_BIT 0x08
+#define PREFERENCE_SHIFT 4
+#define PREVIOUS_SHIFT 6
+
+	budget_update u;
+	branch_info bi;
+	budget_lookup last; // From the last predict, for update
+	unsigned int global_history, short_history, medium_history;
+	unsigned int table_bits;
+	unsigned int global_length;			   // Global history bits that fit in an index
+	unsigned char *table;				   // 1 << table_bits packed entries
+	unsigned char history_choice[3][3];	   // History to use for [preference][previous]: 0 long, 1 medium, 2 short
+
+	budget_predictor(unsigned long kilobytes) : global_history(0), short_history(0), medium_history(0)
+	{
+		table_bits = BUDGET_MIN_TABLE_BITS;
+		while (table_bits < 30 && (2ul << table_bits) <= kilobytes * 1024ul)
+		{
+			table_bits++;
+		}
+		global_length = table_bits < BUDGET_GLOBAL_HISTORY_LENGTH ? table_bits : BUDGET_GLOBAL_HISTORY_LENGTH;
+		table = new unsigned char[1u << table_bits];
+		memset(table, 0, 1u << table_bits);
+
+		// The same weighted vote my_predictor makes on every prediction, worked
+		// out once for the nine possible inputs
+		for (int preference = 0; preference < 3; preference++)
+		{
+			for (int previous = 0; previous < 3; previous++)
+			{
+				int weight = (0.8) * (preference) + (1 - 0.8) * (previous);
+				history_choice[preference][previous] = weight >= 2 * 0.8 + (1 - 0.8) ? 2 : weight >= 1 ? 1 : 0;
+			}
+		}
+	}
+
+	~budget_predictor(void)
+	{
+		delete[] table;
+	}
+
+	// Read "budget" (64 KB) or "budget:KB", the spelling both predict and
+	// cpusim take; false for anything else, or a budget the smallest table
+	// does not fit in
+	static bool parse_spec(const char *spec, unsigned long &kilobytes)
+	{
+		if (strcmp(spec, "budget") == 0)
+		{
+			kilobytes = 64;
+			return true;
+		}
+		if (strncmp(spec, "budget:", 7) != 0 || spec[7] < '0' || spec[7] > '9')
+		{
+			return false;
+		}
+		char *end;
+		kilobytes = strtoul(spec + 7, &end, 0);
+		return *end == '\0' && kilobytes * 1024 >= (1ul << BUDGET_MIN_TABLE_BITS);
+	}
+
+	// Bytes of predictor state actually held
+	unsigned long storage_bytes(void)
+	{
+		return 1ul << table_bits;
+	}
+
+	bool taken_at(unsigned int i)
+	{
+		return (table[i] & COUNTER_MASK) >= 4;
+	}
+
+	// Look up a conditional branch at address under the current histories
+	void lookup(unsigned int address, budget_lookup &l)
+	{
+		unsigned int global_index = global_history << (table_bits - global_length);
+		unsigned int short_index = short_history << (table_bits - BUDGET_SHORT_HISTORY_LENGTH);
+		unsigned int medium_index = medium_history << (table_bits - BUDGET_MEDIUM_HISTORY_LENGTH);
+		unsigned int local_index = address & ((1u << table_bits) - 1);
+
+		l.short_vs_medium_long[0] = taken_at(global_index ^ local_index);
+		l.short_vs_medium_long[1] = taken_at(medium_index ^ local_index);
+		l.short_vs_medium_long[2] = taken_at(short_index ^ local_index);
+
+		l.index = global_index ^ local_index;
+		unsigned char entry = table[l.index];
+
+		// Pick the history length from the weighted preference
+		unsigned char choice = history_choice[(entry >> PREFERENCE_SHIFT) & 3][entry >> PREVIOUS_SHIFT];
+		if (choice == 1)
+		{
+			global_index = medium_index;
+		}
+		else if (choice == 2)
+		{
+			global_index = short_index;
+		}
+
+		// Local history alone unless the combined one has been more accurate
+		l.u_index = (entry & ACCURACY_BIT) ? global_index ^ local_index : local_index;
+
+		l.global_vs_local[0] = taken_at(global_index);
+		l.global_vs_local[1] = taken_at(global_index ^ local_index);
+		l.prediction = taken_at(l.u_index);
+	}
+
+	// Train on the outcome of the conditional branch looked up in l
+	void train(budget_lookup &l, bool taken)
+	{
+		unsigned char *counter = &table[l.u_index];
+		unsigned int count = *counter & COUNTER_MASK;
+		if (taken && count < COUNTER_MASK)
+		{
+			(*counter)++;
+		}
+		else if (!taken && count > 0)
+		{
+			(*counter)--;
+		}
+
+		global_history = ((global_history << 1) | taken) & ((1u << global_length) - 1);
+		short_history = ((short_history << 1) | taken) & ((1u << BUDGET_SHORT_HISTORY_LENGTH) - 1);
+		medium_history = ((medium_history << 1) | taken) & ((1u << BUDGET_MEDIUM_HISTORY_LENGTH) - 1);
+
+		// Selector fields, all in the entry at index
+		unsigned char entry = table[l.index];
+		if (l.global_vs_local[1] == taken)
+		{
+			entry |= ACCURACY_BIT;
+		}
+		else if (l.global_vs_local[0] == taken)
+		{
+			entry &= ~ACCURACY_BIT;
+		}
+
+		unsigned int preference = (entry >> PREFERENCE_SHIFT) & 3;
+		if (l.short_vs_medium_long[0] == taken)
+		{
+			preference = 0;
+		}
+		else if (l.short_vs_medium_long[2] == taken)
+		{
+			preference = 2;
+		}
+		else if (l.short_vs_medium_long[1] == taken)
+		{
+			preference = 1;
+		}
+		// The old preference becomes the previous one
+		entry = (entry & (COUNTER_MASK | ACCURACY_BIT)) | (preference << PREFERENCE_SHIFT) |
+				(((entry >> PREFERENCE_SHIFT) & 3) << PREVIOUS_SHIFT);
+		table[l.index] = entry;
+	}
+
+	branch_update *predict(branch_info &b)
+	{
+		bi = b;
+		if (b.br_flags & BR_CONDITIONAL)
+		{
+			lookup(b.address, last);
+			u.index = last.u_index;
+			u.direction_prediction(last.prediction);
+		}
+		else
+		{
+			// For non-conditional branches, always predict taken
+			u.direction_prediction(true);
+		}
+
+		u.target_prediction(0);
+		return &u;
+	}
+
+	void update(branch_update *u, bool taken, unsigned int /* target */)
+	{
+		if (bi.br_flags & BR_CONDITIONAL)
+		{
+			last.u_index = ((budget_update *)u)->index;
+			train(last, taken);
+		}
+	}
+
+	void predict_batch(branch_info *b, bool *taken, unsigned int * /* target */, int n, bool *direction, unsigned int *target_pred)
+	{
+		// The histories as they will be at branch ahead, run forward from
+		// the outcomes so its entries can be fetched before they are needed
+		unsigned int mask = (1u << table_bits) - 1;
+		unsigned int global = global_history, shorter = short_history, medium = medium_history;
+		int distance = table_bits >= BUDGET_PREFETCH_MIN_BITS ? BUDGET_PREFETCH_DISTANCE : 0;
+		int ahead = 0;
+
+		for (int i = 0; i < n; i++)
+		{
+			for (; ahead < n && ahead < i + distance; ahead++)
+			{
+				if (!(b[ahead].br_flags & BR_CONDITIONAL))
+				{
+					continue;
+				}
+				unsigned int local_index = b[ahead].address & mask;
+				prefetch(local_index);
+				prefetch((global << (table_bits - global_length)) ^ local_index);
+				prefetch((medium << (table_bits - BUDGET_MEDIUM_HISTORY_LENGTH)) ^ local_index);
+				prefetch((shorter << (table_bits - BUDGET_SHORT_HISTORY_LENGTH)) ^ local_index);
+
+				global = ((global << 1) | taken[ahead]) & ((1u << global_length) - 1);
+				shorter = ((shorter << 1) | taken[ahead]) & ((1u << BUDGET_SHORT_HISTORY_LENGTH) - 1);
+				medium = ((medium << 1) | taken[ahead]) & ((1u << BUDGET_MEDIUM_HISTORY_LENGTH) - 1);
+			}
+
+			target_pred[i] = 0;
+			if (b[i].br_flags & BR_CONDITIONAL)
+			{
+				budget_lookup l;
+				lookup(b[i].address, l);
+				direction[i] = l.prediction;
+				train(l, taken[i]);
+			}
+			else
+			{
+				direction[i] = true;
+			}
+		}
+	}
+
+	void prefetch(unsigned int i)
+	{
+#if defined(__GNUC__)
+		__builtin_prefetch(&table[i]);
+#endif
+	}
+};
@@ -0,0 +1,180 @@
+// pipeline.cc
+// This file contains the threaded trace reader.  The stages are connected
+// by lock-free rings, so the decompressor, the decoder and the predictors
+// run on separate cores without taking a lock per trace.
+
+#include <stdio.h>
+#include <atomic>
+#include <thread>
+
+#include "branch.h"
+#include "trace.h"
+#include "pipeline.h"
+
+// sizes of the chunks the decompressor thread reads, and of the rings
+
+#define CHUNK_SIZE	(1<<16)
+#define N_CHUNKS	16
+#define N_BATCHES	16
+
+// a ring of n slots filled by one thread and read, in order, by each of
+// its consumers.  every consumer has its own cursor, so the producer and
+// each consumer form a single-producer single-consumer queue; a slot is
+// only refilled once the slowest consumer is done with it.
+
+template <class T, int n> struct ring {
+	T slot[n];
+	std::atomic<unsigned long> head;
+	std::atomic<unsigned long> tail[MAX_CONSUMERS];
+	int consumers;
+
+	void init (int c) {
+		consumers = c;
+		head.store (0);
+		for (int i=0; i<c; i++) tail[i].store (0);
+	}
+
+	// the slot to fill next, once every consumer has finished with it
+
+	T *claim (void) {
+		unsigned long h = head.load (std::memory_order_relaxed);
+		for (;;) {
+			unsigned long oldest = h;
+			for (int i=0; i<consumers; i++) {
+				unsigned long t = tail[i].load (std::memory_order_acquire);
+				if (t < oldest) oldest = t;
+			}
+			if (h - oldest < n) return &slot[h % n];
+			std::this_thread::yield ();
+		}
+	}
+
+	// hand the claimed slot to the consumers
+
+	void publish (void) {
+		head.store (head.load (std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	// consumer c's next slot, waiting for it to be published
+
+	T *peek (int c) {
+		unsigned long t = tail[c].load (std::memory_order_relaxed);
+		while (head.load (std::memory_order_acquire) == t) std::this_thread::yield ();
+		return &slot[t % n];
+	}
+
+	// consumer c is done with the slot from peek
+
+	void release (int c) {
+		tail[c].store (tail[c].load (std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+};
+
+// bytes read from the decompressor; size 0 means end of file
+
+struct chunk {
+	size_t size;
+	unsigned char data[CHUNK_SIZE];
+};
+
+static ring<chunk, N_CHUNKS> chunks;
+static ring<trace_batch, N_BATCHES> batches;
+static std::thread decompressor, decoder;
+
+// true once the decoder has a chunk it has not released yet
+
+static bool holding;
+
+// true once the decoder has seen the end-of-file chunk; the decompressor
+// has exited by then, so the ring will never be filled again
+
+static bool at_end;
+
+// stage 1: copy the decompressor's output into chunks
+
+static void decompress (void) {
+	for (;;) {
+		chunk *c = chunks.claim ();
+		c->size = fread (c->data, 1, CHUNK_SIZE, tracefp);
+		chunks.publish ();
+		if (c->size == 0) break;
+	}
+}
+
+// read_byte's source of bytes on the decoder thread: the next chunk
+
+static size_t next_chunk (unsigned char **p) {
+	if (at_end) return 0;
+	if (holding) chunks.release (0);
+	chunk *c = chunks.peek (0);
+	holding = true;
+	*p = c->data;
+	if (c->size == 0) at_end = true;
+	return c->size;
+}
+
+// stage 2: decode traces into batches
+
+static void decode (void) {
+	for (;;) {
+		trace_batch *b = batches.claim ();
+		fill_batch (b);
+		batches.publish ();
+		if (b->n < BATCH_SIZE) break;
+	}
+}
+
+// read up to BATCH_SIZE traces from the open trace file into b (also used
+// without the threads); returns how many
+
+int fill_batch (trace_batch *b) {
+	b->n = 0;
+	while (b->n < BATCH_SIZE) {
+		trace *t = read_trace ();
+		if (!t) break;
+		b->bi[b->n] = t->bi;
+		b->taken[b->n] = t->taken;
+		b->target[b->n] = t->target;
+		b->n++;
+	}
+	return b->n;
+}
+
+// open the trace file and start the decompressor and decoder threads for
+// the given number of consumers
+
+void start_pipeline (char *fname, int consumers) {
+	init_trace (fname);
+	refill = next_chunk;
+	holding = false;
+	at_end = false;
+	chunks.init (1);
+	batches.init (consumers);
+
+	// a trace cache is read straight from its mapping by the decoder
+
+	if (!trace_is_cached ()) decompressor = std::thread (decompress);
+	decoder = std::thread (decode);
+}
+
+// consumer c's next batch of traces, in trace order
+
+trace_batch *next_batch (int c) {
+	return batches.peek (c);
+}
+
+// consumer c is done with its batch from next_batch
+
+void release_batch (int c) {
+	batches.release (c);
+}
+
+// wait for the threads once every consumer has seen the last batch, and
+// close the trace file
+
+void end_pipeline (void) {
+	decoder.join ();
+	if (decompressor.joinable ()) decompressor.join ();
+	refill = NULL;
+	end_trace ();
+}
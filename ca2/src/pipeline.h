@@ -0,0 +1,24 @@
+// pipeline.h
+// This file declares a threaded reader for trace files.  A decompressor
+// thread reads the output of gzip or bzip2 in big chunks, a decoder thread
+// turns those into batches of traces with read_trace, and any number of
+// consumers (one per predictor thread) each see every batch, in order.
+
+#define BATCH_SIZE	4096
+#define MAX_CONSUMERS	64
+
+// traces by field, the way branch_predictor::predict_batch takes them
+
+struct trace_batch {
+	int n;			// traces in this batch; the last batch is not full
+	branch_info bi[BATCH_SIZE];
+	bool taken[BATCH_SIZE];
+	unsigned int target[BATCH_SIZE];
+};
+
+int fill_batch (trace_batch *);
+
+void start_pipeline (char *, int);
+trace_batch *next_batch (int);
+void release_batch (int);
+void end_pipeline (void);
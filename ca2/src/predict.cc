@@ -1,85 +1,189 @@
 // predict.cc
-// This file contains the main function.  The program accepts a single 
-// parameter: the name of a trace file.  It drives the branch predictor
+// This file contains the main function.  The program accepts the name of a
+// trace file, optionally followed by one or more predictors to evaluate:
+// "my" for my_predictor, or "budget:KB" for budget_predictor in a storage
+// budget of KB kilobytes ("budget" alone is 64 KB), as cpusim spells it.
+// Without any it runs my_predictor.  It drives the branch predictor
 // simulation by reading the trace file and feeding the traces one at a time
-// to the branch predictor.
+// to every predictor, so a sweep over several configurations decompresses
+// the trace only once.  With -j N (and by default on a multicore host)
+// decompression, decoding and prediction run on separate threads, with the
+// predictors split over N predictor threads; -j 0 does it all on one.
+// predict -w <cache> <trace> decodes a trace once into a flat trace cache,
+// which predict then reads from an mmap instead of decompressing again.
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h> // in case you want to use e.g. memset
 #include <assert.h>
+#include <thread>
+#include <vector>
 
 #include "branch.h"
 #include "trace.h"
 #include "predictor.h"
 #include "my_predictor.h"
+#include "budget_predictor.h"
+#include "pipeline.h"
 
-int main (int argc, char *argv[]) {
+// one predictor under evaluation, with its statistics (currently just for
+// conditional branches)
 
-	// make sure there is one parameter
+struct contender {
+	const char *name;
+	branch_predictor *p;
+	long long int 
+		tmiss, 	// number of target mispredictions
+		dmiss; 	// number of direction mispredictions
+};
 
-	if (argc != 2) {
-		fprintf (stderr, "Usage: %s <filename>.gz\n", argv[0]);
-		exit (1);
-	}
+// send a batch of traces to a competitor and score its predictions
 
-	// open the trace file for reading
+static void feed (contender & c, trace_batch *b) {
 
-	init_trace (argv[1]);
+	// send the traces to the competitor's code for prediction; it
+	// updates its state with each outcome as it goes
 
-	// initialize competitor's branch prediction code
+	static thread_local bool direction[BATCH_SIZE];
+	static thread_local unsigned int target[BATCH_SIZE];
+	c.p->predict_batch (b->bi, b->taken, b->target, b->n, direction, target);
 
-	branch_predictor *p = new my_predictor ();
-	// branch_predictor *p = new TAGE ();
+	// collect statistics for conditional branch traces
 
-	// some statistics to keep, currently just for conditional branches
+	for (int j = 0; j < b->n; j++) {
+		if (b->bi[j].br_flags & BR_CONDITIONAL) {
 
-	long long int 
-		tmiss = 0, 	// number of target mispredictions
-		dmiss = 0; 	// number of direction mispredictions
+			// count a direction misprediction
 
-	// keep looping until end of file
+			c.dmiss += direction[j] != b->taken[j];
+
+			// count a target misprediction
 
+			c.tmiss += target[j] != b->target[j];
+		}
+	}
+}
+
+// predictor thread k of threads: every batch from the pipeline goes to
+// competitors k, k + threads, ...
+
+static void predictor_thread (contender *c, int n, int k, int threads) {
 	for (;;) {
+		trace_batch *b = next_batch (k);
+		for (int i = k; i < n; i += threads)
+			feed (c[i], b);
+		bool last = b->n < BATCH_SIZE;
+		release_batch (k);
+		if (last) break;
+	}
+}
 
-		// get a trace
+int main (int argc, char *argv[]) {
 
-		trace *t = read_trace ();
+	// predictor threads: the cores left after decompressing and
+	// decoding, or none (everything serial) on a single core
+
+	int cores = std::thread::hardware_concurrency ();
+	int threads = cores > 3 ? cores - 2 : cores > 1 ? 1 : 0;
+	char *program = argv[0];
+	char *cache_out = NULL;
+	while (argc > 2 && argv[1][0] == '-') {
+		if (strcmp (argv[1], "-j") == 0)
+			threads = atoi (argv[2]);
+		else if (strcmp (argv[1], "-w") == 0)
+			cache_out = argv[2];
+		else
+			break;
+		argc -= 2;
+		argv += 2;
+	}
 
-		// NULL means end of file
+	// make sure there is a trace file
 
-		if (!t) break;
+	if (argc < 2) {
+		fprintf (stderr, "Usage: %s [-j threads] <filename>.gz [my | budget[:KB]]...\n", program);
+		fprintf (stderr, "       %s -w <cache>.btrc <filename>.gz\n", program);
+		exit (1);
+	}
 
-		// send this trace to the competitor's code for prediction
+	// just decode the trace into a trace cache?
 
-		branch_update *u = p->predict (t->bi);
+	if (cache_out) {
+		long long int count = write_trace_cache (argv[1], cache_out);
+		if (count < 0) {
+			perror (cache_out);
+			exit (1);
+		}
+		printf ("%lld traces written to %s\n", count, cache_out);
+		exit (0);
+	}
 
-		// collect statistics for a conditional branch trace
+	// initialize competitors' branch prediction code
+
+	int n = argc > 2 ? argc - 2 : 1;
+	contender *c = new contender[n];
+	for (int i = 0; i < n; i++) {
+		unsigned long kilobytes;
+		c[i].name = argc > 2 ? argv[i + 2] : "my";
+		c[i].tmiss = 0;
+		c[i].dmiss = 0;
+		if (strcmp (c[i].name, "my") == 0)
+			c[i].p = new my_predictor ();
+		else if (budget_predictor::parse_spec (c[i].name, kilobytes))
+			c[i].p = new budget_predictor (kilobytes);
+		else if (strncmp (c[i].name, "budget", 6) == 0) {
+			fprintf (stderr, "%s: bad budget %s (the smallest table needs 1 KB)\n", program, c[i].name);
+			exit (1);
+		} else {
+			fprintf (stderr, "%s: unknown predictor %s\n", program, c[i].name);
+			exit (1);
+		}
+		// c[i].p = new TAGE ();
+	}
 
-		if (t->bi.br_flags & BR_CONDITIONAL) {
+	if (threads > n) threads = n;
+	if (threads > MAX_CONSUMERS) threads = MAX_CONSUMERS;
+	if (threads > 0) {
 
-			// count a direction misprediction
+		// decompress and decode on two threads of their own, and
+		// predict on the rest
 
-			dmiss += u->direction_prediction () != t->taken;
+		start_pipeline (argv[1], threads);
+		std::vector<std::thread> workers;
+		for (int k = 0; k < threads; k++)
+			workers.push_back (std::thread (predictor_thread, c, n, k, threads));
+		for (int k = 0; k < threads; k++)
+			workers[k].join ();
+		end_pipeline ();
+	} else {
 
-			// count a target misprediction
+		// open the trace file for reading
 
-			tmiss += u->target_prediction () != t->target;
-		}
+		init_trace (argv[1]);
 
-		// update competitor's state
+		// keep looping until end of file, a batch of traces at a time
 
-		p->update (u, t->taken, t->target);
-	}
+		trace_batch *b = new trace_batch;
+		while (fill_batch (b) > 0)
+			for (int i = 0; i < n; i++)
+				feed (c[i], b);
+		delete b;
 
-	// done reading traces
+		// done reading traces
 
-	end_trace ();
+		end_trace ();
+	}
 
 	// give final mispredictions per kilo-instruction and exit.
 	// each trace represents exactly 100 million instructions.
+	// a single predictor keeps the one-line output the run script reads
 
-	printf ("%0.3f MPKI\n", 1000.0 * (dmiss / 1e8));
-	delete p;
+	for (int i = 0; i < n; i++) {
+		if (n > 1)
+			printf ("%-12s ", c[i].name);
+		printf ("%0.3f MPKI\n", 1000.0 * (c[i].dmiss / 1e8));
+		delete c[i].p;
+	}
+	delete[] c;
 	exit (0);
 }
@@ -20,5 +20,21 @@ class branch_predictor {
 public:
 	virtual branch_update *predict (branch_info &) = 0;
 	virtual void update (branch_update *, bool, unsigned int) {}
+
+	// predict and then update with each of n branches in turn, leaving
+	// what was predicted for branch i in direction[i] and target_pred[i].
+	// a predictor can do this natively, without a virtual call and a
+	// branch_update per branch; by default it is just predict and update
+
+	virtual void predict_batch (branch_info *b, bool *taken, unsigned int *target, int n,
+		bool *direction, unsigned int *target_pred) {
+		for (int i=0; i<n; i++) {
+			branch_update *u = predict (b[i]);
+			direction[i] = u->direction_prediction ();
+			target_pred[i] = u->target_prediction ();
+			update (u, taken[i], target[i]);
+		}
+	}
+
 	virtual ~branch_predictor (void) {}
 };
@@ -9,6 +9,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "branch.h"
 #include "trace.h"
@@ -54,6 +58,15 @@ FILE *tracefp;
 
 unsigned char buf[BUFSIZE];
 
+// bytes being read; buf, or whatever refill handed over
+
+static unsigned char *bufp = buf;
+
+// where more bytes come from when not straight from tracefp (the
+// pipelined reader sets this); returns how many and points at them
+
+size_t (*refill) (unsigned char **) = NULL;
+
 // current position in buffer
 unsigned int bufpos;
 
@@ -76,7 +89,12 @@ unsigned char read_byte (void) {
 		// get a BUFSIZE-sized chunk of bytes from the input
 
 		bufpos = 0;
-		bufsize = fread (buf, 1, BUFSIZE, tracefp);
+		if (refill)
+			bufsize = refill (&bufp);
+		else {
+			bufp = buf;
+			bufsize = fread (buf, 1, BUFSIZE, tracefp);
+		}
 
 		// nothing to read?  we must be done.
 
@@ -88,7 +106,7 @@ unsigned char read_byte (void) {
 
 	// one more byte 
 
-	return buf[bufpos++];
+	return bufp[bufpos++];
 }
 
 // read an unsigned integer in little endian format from the trace file
@@ -103,6 +121,12 @@ unsigned int read_uint (void) {
 	return x0 | (x1 << 8) | (x2 << 16) | (x3 << 24);
 }
 
+// the mapped records when reading a trace cache, otherwise NULL
+
+static btrc_record *cache;
+static size_t cache_bytes;
+static long long int cache_count, cache_pos;
+
 // these "remember" structs and functions handle decompressing certain traces
 // using prediction.  the compression is a simple table-based predictor that
 // also uses a return address stack for predicting return addresses.  
@@ -216,6 +240,19 @@ trace *read_trace (void) {
 	static trace t;
 	bool ras_correct, ras_offby2, ras_offby3, correct;
 
+	// a trace cache has every trace already decoded
+
+	if (cache) {
+		if (cache_pos == cache_count) return NULL;
+		btrc_record *b = &cache[cache_pos++];
+		t.bi.address = b->address;
+		t.bi.opcode = b->opcode;
+		t.bi.br_flags = b->br_flags;
+		t.target = b->target;
+		t.taken = b->taken;
+		return & t;
+	}
+
 	// read the next byte; it will either be a code, a set index for
 	// a correct prediction, or a prefix for patching a return address 
 	// prediction.
@@ -429,8 +466,37 @@ void init_trace (char *fname) {
 	if (!f) {
 		perror (fname);
 	}
-	fread (s, 1, 2, f);
+	char magic[16] = { 0 };
+	size_t got = fread (magic, 1, 16, f);
 	fclose (f);
+	memcpy (s, magic, 2);
+
+	// a trace cache is mapped rather than piped
+
+	cache = NULL;
+	if (got == 16 && strncmp (magic, BTRC_MAGIC, 4) == 0) {
+		int fd = open (fname, O_RDONLY);
+		struct stat st;
+		unsigned int version;
+		memcpy (&version, magic + 4, 4);
+		memcpy (&cache_count, magic + 8, 8);
+		if (fd < 0 || fstat (fd, &st) != 0 || version != BTRC_VERSION
+		 || (size_t) st.st_size != 16 + cache_count * sizeof (btrc_record)) {
+			fprintf (stderr, "%s: bad trace cache\n", fname);
+			exit (1);
+		}
+		cache_bytes = st.st_size;
+		void *map = mmap (NULL, cache_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+		close (fd);
+		if (map == MAP_FAILED) {
+			perror (fname);
+			exit (1);
+		}
+		cache = (btrc_record *) ((char *) map + 16);
+		cache_pos = 0;
+		end_of_file = false;
+		return;
+	}
 	if (strncmp (s, GZIP_MAGIC, 2) == 0) 
 		dc = ZCAT;
 	else if (strncmp (s, BZIP2_MAGIC, 2) == 0)
@@ -457,5 +523,54 @@ void init_trace (char *fname) {
 // close the trace file
 
 void end_trace (void) {
-	fclose (tracefp);
+	if (cache) {
+		munmap ((char *) cache - 16, cache_bytes);
+		cache = NULL;
+	} else
+		fclose (tracefp);
+}
+
+// true if the open trace is a trace cache
+
+bool trace_is_cached (void) {
+	return cache != NULL;
+}
+
+// decode the trace fname once and write it to the trace cache out;
+// returns the number of traces, or -1 if out cannot be written
+
+long long int write_trace_cache (char *fname, char *out) {
+	FILE *f = fopen (out, "wb");
+	if (!f) return -1;
+
+	// the count is patched in at the end
+
+	char header[16];
+	unsigned int version = BTRC_VERSION;
+	long long int count = 0;
+	memcpy (header, BTRC_MAGIC, 4);
+	memcpy (header + 4, &version, 4);
+	memcpy (header + 8, &count, 8);
+	fwrite (header, 1, 16, f);
+
+	init_trace (fname);
+	for (;;) {
+		trace *t = read_trace ();
+		if (!t) break;
+		btrc_record b;
+		b.address = t->bi.address;
+		b.target = t->target;
+		b.opcode = t->bi.opcode;
+		b.br_flags = t->bi.br_flags;
+		b.taken = t->taken;
+		b.pad = 0;
+		fwrite (&b, sizeof (b), 1, f);
+		count++;
+	}
+	end_trace ();
+
+	fseek (f, 8, SEEK_SET);
+	fwrite (&count, 8, 1, f);
+	if (fclose (f) != 0) return -1;
+	return count;
 }
@@ -15,6 +15,24 @@ struct trace {
 	branch_info bi;
 };
 
+// a trace cache is a trace already decoded into fixed-width records, so
+// reading it back is a walk over an mmap.  the file is the magic "BTRC",
+// a 4-byte version and an 8-byte record count, followed by the records
+// (little endian, as on every host this runs on).
+
+#define BTRC_MAGIC	"BTRC"
+#define BTRC_VERSION	1
+
+struct btrc_record {
+	unsigned int address, target;
+	unsigned char opcode, br_flags, taken, pad;
+};
+
+extern FILE *tracefp;
+extern size_t (*refill) (unsigned char **);
+
 void init_trace (char *);
 trace *read_trace (void);
 void end_trace (void);
+bool trace_is_cached (void);
+long long int write_trace_cache (char *, char *);
@@ -0,0 +1,25 @@
+#!/bin/sh
+# run predict on every test trace, without the reader threads and with
+# them, and compare its output with <name>-GT.txt
+#
+# tests/run_tests.sh ./src/predict   (from ca2)
+# truncated.trace.gz ends partway through a record
+
+predict=${1:-./src/predict}
+dir=$(dirname "$0")
+failed=0
+
+for expected in "$dir"/*-GT.txt; do
+	name=${expected%-GT.txt}
+	for threads in 0 1 2; do
+		# a hang is a failure too
+		got=$(timeout 10 "$predict" -j $threads "$name".trace.* budget:4 2>&1)
+		if [ "$got" != "$(cat "$expected")" ]; then
+			echo "FAIL $(basename "$name") -j $threads: got '$got'"
+			failed=1
+		fi
+	done
+done
+
+[ $failed -eq 0 ] && echo "all tests passed"
+exit $failed